@@ -1,225 +1,8486 @@
-#include <iostream>
-#include <vector>
-#include <functional>
-#include <string>
-#include <stdexcept>
-#include <chrono>
-#include <random>
-
-using namespace std;
-using namespace std::chrono;
-
-// I am creating a templated hash table class using linear probing for collision resolution.
-template<typename K, typename V>
-class HashTableLinearProbing {
-private:
-    struct Entry {
-        K key;                // The key of the entry
-        V value;              // The value associated with the key
-        bool occupied = false;// Flag to indicate if the slot has been occupied
-        bool active = true;   // Flag to check if the slot is actively used or marked as deleted
-
-        // Default constructor for an empty entry
-        Entry() : occupied(false), active(false) {}
-
-        // Constructor to initialize an entry with a key and a value
-        Entry(K k, V v) : key(k), value(v), occupied(true), active(true) {}
-    };
-
-    vector<Entry> table;      // The table is a vector of entries
-    int capacity;             // Maximum number of entries in the hash table
-    int size;                 // Current number of active entries
-
-    // This function calculates the index for a key using the standard hash function and modulo operation.
-    int hashFunction(K key) const {
-        hash<K> hashObj;
-        return hashObj(key) % capacity;
-    }
-
-public:
-    // Constructor to initialize the hash table with a specified capacity.
-    HashTableLinearProbing(int capacity = 15000) : capacity(capacity), size(0), table(capacity) {}
-
-    // Method to insert a key-value pair into the hash table.
-    void insert(K key, V value) {
-        int index = hashFunction(key); // Calculate the index using the hash function.
-        int start_index = index;       // Remember the start index to detect when we've looped through the entire table.
-
-        // Keep probing linearly until an empty or deletable spot is found.
-        while (table[index].occupied && table[index].key != key) {
-            index = (index + 1) % capacity; // Move to the next index.
-            if (index == start_index) {     // If we return to the start, the table is full.
-                throw overflow_error("Hash table is full");
-            }
-        }
-
-        table[index] = Entry(key, value);  // Place the entry in the found spot.
-        if (!table[index].active) {        // If the spot was previously deactivated, reactivate it.
-            table[index].active = true;
-            size++;
-        }
-    }
-
-    // Method to retrieve the value associated with a key.
-    V retrieve(K key) {
-        int index = hashFunction(key);   // Calculate the index.
-        int start_index = index;         // Store the start index to avoid infinite loops.
-
-        // Probe until an unoccupied slot or the full loop around the table is detected.
-        while (table[index].occupied) {
-            if (table[index].key == key && table[index].active) { // Check if the active key matches.
-                return table[index].value;
-            }
-            index = (index + 1) % capacity;
-            if (index == start_index) { // If we've checked the whole table, the key isn't here.
-                break;
-            }
-        }
-
-        throw runtime_error("Key not found");  // Key was not found.
-    }
-
-    // Method to remove an entry by key.
-    bool remove(K key) {
-        int index = hashFunction(key);   // Find the index for the key.
-        int start_index = index;         // Remember the start index.
-
-        // Probe until we find an unoccupied slot or circle back to the start.
-        while (table[index].occupied) {
-            if (table[index].key == key && table[index].active) {
-                table[index].active = false; // Deactivate the entry.
-                size--;
-                return true;  // Successfully removed.
-            }
-            index = (index + 1) % capacity;
-            if (index == start_index) {
-                break;
-            }
-        }
-
-        return false;  // The key was not found for removal.
-    }
-
-    // Method to perform performance tests on the hash table operations.
-    void performTest(int numOperations) {
-        vector<string> keys(numOperations);
-        vector<int> values(numOperations);
-        random_device rd;  // Random device to seed the generator for random keys and values.
-        mt19937 eng(rd());
-        uniform_int_distribution<> distr(100000, 999999);
-
-        // Record the start time of the insert operations.
-        auto insert_start = high_resolution_clock::now();
-        for (int i = 0; i < numOperations; ++i) {
-            keys[i] = "key" + to_string(distr(eng));  // Generate random keys.
-            values[i] = distr(eng);                  // Generate random values.
-            insert(keys[i], values[i]);              // Insert them into the hash table.
-        }
-        auto insert_end = high_resolution_clock::now();  // Record the end time.
-
-        // Record the start time of the retrieve operations.
-        auto retrieve_start = high_resolution_clock::now();
-        for (int i = 0; i < numOperations; ++i) {
-            retrieve(keys[i]);  // Retrieve each key to measure performance.
-        }
-        auto retrieve_end = high_resolution_clock::now();  // Record the end time.
-
-        // Start timing the remove operations.
-        auto remove_start = high_resolution_clock::now();
-        for (int i = 0; i < numOperations; ++i) {
-            remove(keys[i]);  // Remove each key to measure performance.
-        }
-        auto remove_end = high_resolution_clock::now();  // Record the end time.
-
-        // Calculate and print the durations of each operation.
-        auto insert_duration = duration_cast<milliseconds>(insert_end - insert_start);
-        auto retrieve_duration = duration_cast<milliseconds>(retrieve_end - retrieve_start);
-        auto remove_duration = duration_cast<milliseconds>(remove_end - remove_start);
-
-        cout << "Performance for " << numOperations << " operations:" << endl;
-        cout << "Insert Duration: " << insert_duration.count() << " ms" << endl;
-        cout << "Retrieve Duration: " << retrieve_duration.count() << " ms" << endl;
-        cout << "Remove Duration: " << remove_duration.count() << " ms" << endl;
-    }
-
-    // Displays the menu for interacting with the hash table from the command line.
-    void displayMenu() {
-        cout << "HASH TABLE OPERATIONS\n";
-        cout << "1. Insert Key/Value\n";
-        cout << "2. Retrieve Value by Key\n";
-        cout << "3. Remove Key\n";
-        cout << "4. Performance Test\n";
-        cout << "5. Exit\n";
-        cout << "Enter your choice: ";
-    }
-};
-
-int main() {
-    HashTableLinearProbing<string, int> hashTable(15000);  // capacity
-
-    int choice;
-
-    while (true) {
-        hashTable.displayMenu();
-        cin >> choice;
-
-        switch (choice) {
-        case 1: {
-            string key;
-            int value;
-            cout << "Enter key: ";
-            cin >> key;
-            cout << "Enter value: ";
-            cin >> value;
-            try {
-                hashTable.insert(key, value);
-                cout << "Inserted (" << key << ", " << value << ") into the Hash Table.\n";
-            }
-            catch (const overflow_error& e) {
-                cout << "Error: " << e.what() << endl;
-            }
-            break;
-        }
-        case 2: {
-            string key;
-            cout << "Enter key: ";
-            cin >> key;
-            try {
-                int value = hashTable.retrieve(key);
-                cout << "Value at key '" << key << "' is " << value << ".\n";
-            }
-            catch (const runtime_error& e) {
-                cout << "Error: " << e.what() << endl;
-            }
-            break;
-        }
-        case 3: {
-            string key;
-            cout << "Enter key: ";
-            cin >> key;
-            if (hashTable.remove(key)) {
-                cout << "Key '" << key << "' has been removed.\n";
-            }
-            else {
-                cout << "Key '" << key << "' not found.\n";
-            }
-            break;
-        }
-        case 4: {
-            int numTests;
-            cout << "Enter number of operations for performance testing (e.g., 100, 1000, 10000): ";
-            cin >> numTests;
-            hashTable.performTest(numTests);
-            break;
-        }
-        case 5:
-            cout << "Exiting program.\n";
-            return 0;
-        default:
-            cout << "Invalid choice. Please try again.\n";
-            break;
-        }
-    }
-
-    return 0;
-}
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <string>
+#include <stdexcept>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <type_traits>
+#include <new>
+#include <sstream>
+#include <mutex>
+#include <deque>
+#include <ctime>
+#include <memory>
+#include <charconv>
+#include <cstring>
+#include <limits>
+// Define HASH_TABLE_EXECUTION_POLICIES to get the std::execution overloads of the parallel methods.
+// It is off by default because <execution> makes some standard libraries link against TBB.
+#if defined(HASH_TABLE_EXECUTION_POLICIES)
+#include <execution>
+#define HASH_TABLE_HAS_EXECUTION 1
+#else
+#define HASH_TABLE_HAS_EXECUTION 0
+#endif
+#if defined(__linux__)
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#endif
+// The io_uring server backend talks to the kernel through raw system calls and only needs the header.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HASH_TABLE_HAS_IO_URING 1
+#endif
+#endif
+#if !defined(HASH_TABLE_HAS_IO_URING)
+#define HASH_TABLE_HAS_IO_URING 0
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+// Returns the position of the lowest set bit of a non-zero 64-bit word.
+inline int countTrailingZeros(uint64_t word) {
+#if defined(_MSC_VER)
+    unsigned long position;
+    _BitScanForward64(&position, word);
+    return static_cast<int>(position);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// Hints the CPU to start loading the cache line holding the given address.
+inline void prefetchAddress(const void* address) {
+#if defined(_MSC_VER)
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    __builtin_prefetch(address);
+#endif
+}
+
+// Scrambles a 64-bit hash (the splitmix64 finalizer). hash<int> and friends return the key itself,
+// so anything that slices bits out of a hash mixes it first.
+constexpr uint64_t mixHash(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Jump consistent hash (Lamping and Veach): maps a key to one of `buckets` buckets so that going
+// from n to n + 1 buckets moves only about 1/(n + 1) of the keys, all of them into the new bucket.
+inline int jumpConsistentHash(uint64_t key, int buckets) {
+    int64_t bucket = -1, next = 0;
+    while (next < buckets) {
+        bucket = next;
+        key = key * 2862933555777941757ULL + 1;
+        next = static_cast<int64_t>((bucket + 1) * (static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1)));
+    }
+    return static_cast<int>(bucket);
+}
+
+// Binary snapshot helpers. Numbers are written in host byte order, strings as a 64-bit length
+// followed by the bytes. Reading past the end of a stream throws.
+template<typename T>
+typename enable_if<is_arithmetic<T>::value>::type writeBinary(ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void writeBinary(ostream& out, const string& value) {
+    writeBinary(out, static_cast<uint64_t>(value.size()));
+    out.write(value.data(), value.size());
+}
+
+template<typename T>
+typename enable_if<is_arithmetic<T>::value>::type readBinary(istream& in, T& value) {
+    if (!in.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+        throw runtime_error("Snapshot is truncated or corrupt");
+    }
+}
+
+inline void readBinary(istream& in, string& value) {
+    uint64_t length;
+    readBinary(in, length);
+    value.resize(length);
+    if (length > 0 && !in.read(&value[0], length)) {
+        throw runtime_error("Snapshot is truncated or corrupt");
+    }
+}
+
+// Every snapshot starts with this magic number followed by one of the kinds below.
+const uint32_t snapshotMagic = 0x50414E53;  // "SNAP"
+enum SnapshotKind : uint32_t {
+    ProbingTableSnapshot = 1,
+    PerfectHashSnapshot = 2,
+    BitcaskHintSnapshot = 3
+};
+
+inline void writeSnapshotHeader(ostream& out, SnapshotKind kind) {
+    writeBinary(out, snapshotMagic);
+    writeBinary(out, static_cast<uint32_t>(kind));
+}
+
+inline void readSnapshotHeader(istream& in, SnapshotKind kind) {
+    uint32_t magic, storedKind;
+    readBinary(in, magic);
+    readBinary(in, storedKind);
+    if (magic != snapshotMagic || storedKind != static_cast<uint32_t>(kind)) {
+        throw runtime_error("Not a snapshot of this table type");
+    }
+}
+
+// The replication change-record format, in the snapshot encoding: a sequence number, the
+// operation, the key and, for inserts, the value. Replication streams batches of them.
+enum ChangeOperation : uint8_t { InsertChange = 1, RemoveChange = 2 };
+
+template<typename K, typename V>
+struct ChangeRecord {
+    uint64_t sequence = 0;          // Position in the log, starting at 1
+    ChangeOperation operation = InsertChange;
+    K key{};
+    V value{};                      // Unused for removals
+};
+
+template<typename K, typename V>
+void writeChangeRecord(ostream& out, const ChangeRecord<K, V>& record) {
+    writeBinary(out, record.sequence);
+    writeBinary(out, static_cast<uint8_t>(record.operation));
+    writeBinary(out, record.key);
+    if (record.operation == InsertChange) {
+        writeBinary(out, record.value);
+    }
+}
+
+// Returns false at a clean end of the stream; throws on a truncated or unknown record.
+template<typename K, typename V>
+bool readChangeRecord(istream& in, ChangeRecord<K, V>& record) {
+    if (in.peek() == char_traits<char>::eof()) {
+        return false;
+    }
+    uint8_t operation;
+    readBinary(in, record.sequence);
+    readBinary(in, operation);
+    if (operation != InsertChange && operation != RemoveChange) {
+        throw runtime_error("Snapshot is truncated or corrupt");
+    }
+    record.operation = static_cast<ChangeOperation>(operation);
+    readBinary(in, record.key);
+    if (record.operation == InsertChange) {
+        readBinary(in, record.value);
+    }
+    return true;
+}
+
+// Probe policies for HashTableLinearProbing. Each one describes the probe sequence of a key:
+//   start(hash, capacity, slotsPerLine) gives the first slot,
+//   next(index, probe, hash, capacity) gives the slot after `probe` slots were checked,
+//   contiguous says whether every probe sequence walks forward through neighbouring slots,
+//   which erase_if and the incremental purge rely on to compact probe runs in place,
+//   id is stored in snapshots so a table is never loaded with a different policy,
+//   fitCapacity(slots) rounds a capacity chosen by the table itself (shrink_to_fit) to one the
+//   policy can use.
+// Quadratic and double hashing only reach every slot when the capacity is a power of two
+// (or a prime, for double hashing); otherwise inserts can fail before the table is full.
+
+// Rounds a capacity up to the next power of two, for probe sequences that need one.
+inline int nextPowerOfTwo(int slots) {
+    int capacity = 1;
+    while (capacity < slots) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Step to the next slot: the original strategy.
+struct LinearProbe {
+    static constexpr bool contiguous = true;
+    static constexpr uint32_t id = 1;
+    static int fitCapacity(int slots) { return slots; }
+    static int start(size_t hashValue, int capacity, int) { return static_cast<int>(hashValue % capacity); }
+    static int next(int index, int, size_t, int capacity) { return index + 1 == capacity ? 0 : index + 1; }
+};
+
+// Triangular probing: offsets 1, 3, 6, 10, ... from the home slot.
+struct QuadraticProbe {
+    static constexpr bool contiguous = false;
+    static constexpr uint32_t id = 2;
+    static int fitCapacity(int slots) { return nextPowerOfTwo(slots); }
+    static int start(size_t hashValue, int capacity, int) { return static_cast<int>(hashValue % capacity); }
+    static int next(int index, int probe, size_t, int capacity) { return static_cast<int>((index + static_cast<long long>(probe)) % capacity); }
+};
+
+// Double hashing: a per-key step size taken from a second, mixed hash. The step is odd for
+// even capacities, so it reaches every slot of a power-of-two table.
+struct DoubleHashProbe {
+    static constexpr bool contiguous = false;
+    static constexpr uint32_t id = 3;
+    static int fitCapacity(int slots) { return nextPowerOfTwo(slots); }
+    static int start(size_t hashValue, int capacity, int) { return static_cast<int>(hashValue % capacity); }
+    static int next(int index, int, size_t hashValue, int capacity) {
+        long long step = capacity > 1 ? 1 + static_cast<long long>(mixHash(hashValue) % (capacity - 1)) : 1;
+        if (capacity % 2 == 0) {
+            step |= 1;
+        }
+        return static_cast<int>((index + step) % capacity);
+    }
+};
+
+// Bucketized probing: the home slot is rounded down to the start of its cache-line sized bucket,
+// so the first probes of a lookup share one cache line, then probing continues linearly.
+struct BucketizedProbe {
+    static constexpr bool contiguous = true;
+    static constexpr uint32_t id = 4;
+    static int fitCapacity(int slots) { return slots; }
+    static int start(size_t hashValue, int capacity, int slotsPerLine) {
+        int index = static_cast<int>(hashValue % capacity);
+        return index - index % slotsPerLine;
+    }
+    static int next(int index, int, size_t, int capacity) { return index + 1 == capacity ? 0 : index + 1; }
+};
+
+// I am creating a templated hash table class using linear probing for collision resolution.
+// The probe sequence is a policy; linear probing is the default.
+template<typename K, typename V, typename ProbePolicy = LinearProbe>
+class HashTableLinearProbing {
+private:
+    struct Entry {
+        K key;                // The key of the entry
+        V value;              // The value associated with the key
+        bool occupied = false;// Flag to indicate if the slot has been occupied
+        bool active = true;   // Flag to check if the slot is actively used or marked as deleted
+        size_t hashValue = 0; // Full hash of the key, cached so the entry can be moved without rehashing
+
+        // Default constructor for an empty entry
+        Entry() : occupied(false), active(false) {}
+
+        // Constructor to initialize an entry with a key, a value and the key's hash
+        Entry(K k, V v, size_t h) : key(move(k)), value(move(v)), occupied(true), active(true), hashValue(h) {}
+    };
+
+    // Slots per 64-byte cache line, which sets the bucket size of BucketizedProbe.
+    static constexpr int slotsPerLine = sizeof(Entry) >= 64 ? 1 : static_cast<int>(64 / sizeof(Entry));
+
+    vector<Entry> table;      // The table is a vector of entries
+    int capacity;             // Maximum number of entries in the hash table
+    int size;                 // Current number of active entries
+    int tombstones;           // Number of deactivated entries still occupying slots
+    vector<uint64_t> liveMask;// One bit per slot, set while the slot holds an active entry
+
+    static constexpr int prefetchDistance = 8; // How many slots ahead for_each prefetches
+
+    // Settings for the automatic compaction done after removals (see setCompactionPolicy).
+    double shrinkBelowLoad = 0;       // Rebuild into a smaller table when size/capacity drops below this; 0 disables
+    double purgeAboveTombstones = 0;  // Purge tombstones when they exceed this fraction of the slots; 0 disables
+    bool incrementalPurge = false;    // Purge a few slots per removal instead of all at once
+    int minimumCapacity = 16;         // Automatic shrinking never goes below this many slots
+    int purgeCursor = -1;             // Empty slot where an incremental purge continues, or -1 when none is running
+    long long purgeRemaining = 0;     // Slots the running incremental purge still has to sweep
+
+    static constexpr double shrinkTargetLoad = 0.5; // Load factor a shrunken table is rebuilt at
+    static constexpr int purgeStepSlots = 1024;         // Slots swept per removal by an incremental purge
+
+    // These functions keep the live-slot bitmap in step with the entries.
+    void markLive(int index) { liveMask[index >> 6] |= uint64_t(1) << (index & 63); }
+    void markDead(int index) { liveMask[index >> 6] &= ~(uint64_t(1) << (index & 63)); }
+
+    // Finds the first live slot at or after index by scanning the bitmap a word at a time.
+    // Returns capacity when there are no more live slots.
+    int nextLive(int index) const {
+        if (index >= capacity) {
+            return capacity;
+        }
+        int word = index >> 6;
+        uint64_t bits = liveMask[word] & (~uint64_t(0) << (index & 63));
+        while (bits == 0) {
+            if (++word == static_cast<int>(liveMask.size())) {
+                return capacity;
+            }
+            bits = liveMask[word];
+        }
+        return (word << 6) + countTrailingZeros(bits);
+    }
+
+    // Calls fn(key, value) for the live slots covered by bitmap words [firstWord, lastWord).
+    // Static so the const and non-const callers share it and fn sees matching constness.
+    template<typename Self, typename Function>
+    static void scanWords(Self& self, int firstWord, int lastWord, Function&& fn) {
+        for (int word = firstWord; word < lastWord; ++word) {
+            uint64_t bits = self.liveMask[word];
+            while (bits != 0) {
+                int index = (word << 6) + countTrailingZeros(bits);
+                bits &= bits - 1;  // Clear the lowest set bit.
+                if (index + prefetchDistance < self.capacity) {
+                    prefetchAddress(&self.table[index + prefetchDistance]);
+                }
+                auto& entry = self.table[index];
+                fn(static_cast<const K&>(entry.key), entry.value);
+            }
+        }
+    }
+
+    static constexpr int wordsPerChunk = 64;   // Bitmap words (64 slots each) handed to a worker at a time
+    static constexpr int parallelEraseThreshold = 1 << 16; // Tables smaller than this are swept on one thread
+
+    // Splits the bitmap into chunks and lets up to `threads` workers claim them one at a time.
+    // work(firstWord, lastWord, chunkNumber) is called once per chunk.
+    template<typename Work>
+    void runChunks(int threads, Work work) const {
+        int wordCount = static_cast<int>(liveMask.size());
+        int chunkCount = (wordCount + wordsPerChunk - 1) / wordsPerChunk;
+        threads = max(1, min(threads, chunkCount));
+        atomic<int> nextChunk(0);
+        auto worker = [&]() {
+            for (int chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+                int firstWord = chunk * wordsPerChunk;
+                work(firstWord, min(firstWord + wordsPerChunk, wordCount), chunk);
+            }
+        };
+
+        vector<thread> pool;
+        for (int i = 1; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();  // The calling thread works too.
+        for (auto& t : pool) {
+            t.join();
+        }
+    }
+
+    static int defaultThreadCount() {
+        return max(1, static_cast<int>(thread::hardware_concurrency()));
+    }
+
+#if HASH_TABLE_HAS_EXECUTION
+    template<typename ExecutionPolicy>
+    static int policyThreadCount() {
+        return is_same<ExecutionPolicy, execution::sequenced_policy>::value ? 1 : defaultThreadCount();
+    }
+#endif
+
+    // This function calculates the full hash of a key using the standard hash function.
+    size_t hashKey(const K& key) const {
+        hash<K> hashObj;
+        return hashObj(key);
+    }
+
+    // This function maps a full hash onto the first slot of its probe sequence.
+    int indexFor(size_t hashValue) const {
+        return ProbePolicy::start(hashValue, capacity, slotsPerLine);
+    }
+
+    // This function calculates the index for a key using the standard hash function and modulo operation.
+    int hashFunction(const K& key) const {
+        return indexFor(hashKey(key));
+    }
+
+    // Finds the slot an insert of the key would use: the slot already holding the key
+    // (active or not) or the first unoccupied one. Throws when the table is full.
+    // The cached hash is compared first so most mismatching slots are skipped without a key compare.
+    int probeForInsert(size_t hashValue, const K& key) const {
+        int index = indexFor(hashValue); // Calculate the index from the hash.
+
+        // Keep probing until an empty or deletable spot is found.
+        for (int probe = 1; table[index].occupied && (table[index].hashValue != hashValue || table[index].key != key); ++probe) {
+            if (probe == capacity) {     // Once as many slots as the table has were checked, the table is full.
+                throw overflow_error("Hash table is full");
+            }
+            index = ProbePolicy::next(index, probe, hashValue, capacity); // Move to the next index.
+        }
+        return index;
+    }
+
+    // Returns whether the slot holds an active entry.
+    bool isActive(int index) const {
+        return table[index].occupied && table[index].active;
+    }
+
+    // Stores an entry in a slot returned by probeForInsert, keeping the size and bitmap in step.
+    void storeAt(int index, size_t hashValue, K&& key, V&& value) {
+        bool wasActive = isActive(index);  // Overwriting a live key keeps the size.
+        if (table[index].occupied && !table[index].active) {
+            tombstones--;                  // Reusing the key's own tombstone.
+        }
+        table[index] = Entry(move(key), move(value), hashValue); // Place the entry in the found spot.
+        if (!wasActive) {                  // A new or previously deactivated entry counts towards the size.
+            markLive(index);
+            size++;
+        }
+    }
+
+    // Returns the slot of the active entry for a key with a known hash, storing a value-initialised
+    // entry there first when the key is missing.
+    int findOrInsertHashed(size_t hashValue, const K& key) {
+        int index = probeForInsert(hashValue, key);
+        if (!isActive(index)) {
+            storeAt(index, hashValue, K(key), V());
+        }
+        return index;
+    }
+
+    // Inserts or overwrites a key whose hash is already known and returns the slot used.
+    int insertHashed(size_t hashValue, K&& key, V&& value) {
+        int index = probeForInsert(hashValue, key);
+        storeAt(index, hashValue, move(key), move(value));
+        return index;
+    }
+
+    // Returns the slot holding the active entry for a key with a known hash, or -1.
+    int findHashed(size_t hashValue, const K& key) const {
+        int index = indexFor(hashValue);
+
+        // Probe until an unoccupied slot is found or as many slots as the table has were checked.
+        for (int probe = 1; table[index].occupied; ++probe) {
+            const Entry& entry = table[index];
+            if (entry.hashValue == hashValue && entry.active && entry.key == key) {
+                return index;
+            }
+            if (probe == capacity) { // If we've checked the whole table, the key isn't here.
+                break;
+            }
+            index = ProbePolicy::next(index, probe, hashValue, capacity);
+        }
+        return -1;
+    }
+
+    // Marks the entry in the given slot as deleted.
+    void deactivate(int index) {
+        table[index].active = false;
+        markDead(index);
+        size--;
+        tombstones++;
+    }
+
+    // Returns the slot count shrink_to_fit would rebuild the table with. The probe policy may round
+    // it up, so it can be no smaller than the current capacity even when minCapacity is.
+    int shrunkCapacity(double targetLoad, int minCapacity) const {
+        return ProbePolicy::fitCapacity(max({ 1, minCapacity, static_cast<int>(size / targetLoad) + 1 }));
+    }
+
+    // Applies the compaction policy after entries were removed. A table that cannot get any
+    // smaller is left to the tombstone purge rather than swept on every removal.
+    void compactIfNeeded() {
+        if (shrinkBelowLoad > 0 && size < shrinkBelowLoad * capacity && shrunkCapacity(shrinkTargetLoad, minimumCapacity) < capacity) {
+            shrink_to_fit(shrinkTargetLoad, minimumCapacity);
+        }
+        else if (purgeCursor >= 0) {
+            purgeStep();
+        }
+        else if (purgeAboveTombstones > 0 && tombstones > purgeAboveTombstones * capacity) {
+            if (incrementalPurge && ProbePolicy::contiguous) {
+                purgeCursor = findEmptySlot(0);
+                purgeRemaining = capacity;
+                if (purgeCursor >= 0) {
+                    purgeStep();
+                }
+                else {
+                    erase_if([](const K&, const V&) { return false; }, defaultThreadCount());
+                }
+            }
+            else {
+                erase_if([](const K&, const V&) { return false; }, defaultThreadCount()); // Sweeps out every tombstone.
+            }
+        }
+    }
+
+    // Returns the first unoccupied slot at or after index (wrapping), or -1 if every slot is occupied.
+    int findEmptySlot(int index) const {
+        for (int scanned = 0; scanned < capacity; ++scanned) {
+            if (!table[index].occupied) {
+                return index;
+            }
+            index = (index + 1) % capacity;
+        }
+        return -1;
+    }
+
+    // Sweeps the next piece of an incremental tombstone purge: from the cursor up to the first
+    // empty slot at least purgeStepSlots further on. The table is fully consistent between steps.
+    void purgeStep() {
+        int first = findEmptySlot(purgeCursor);  // An insert may have filled the old cursor slot.
+        if (first < 0) {
+            purgeCursor = -1;
+            return;
+        }
+        int stop = findEmptySlot((first + purgeStepSlots) % capacity);
+        long long swept = (stop - first + capacity) % capacity;
+        if (swept == 0) {
+            swept = capacity;  // The only empty slot; this step covers the whole table.
+        }
+        auto never = [](const K&, const V&) { return false; };
+        tombstones -= sweepSegment(first, stop, never, true).second;
+        purgeRemaining -= swept;
+        purgeCursor = purgeRemaining > 0 ? stop : -1;
+    }
+
+    // Moves an entry into the first unoccupied slot of its probe sequence and returns that slot.
+    // Only used when the key is known not to be in the table, so no key comparisons are needed.
+    // The live bitmap is left to the caller.
+    int placeEntry(Entry&& entry) {
+        int index = indexFor(entry.hashValue);  // The cached hash saves rehashing the key.
+        for (int probe = 1; table[index].occupied; ++probe) {
+            if (probe == capacity) {
+                throw overflow_error("Hash table is full");
+            }
+            index = ProbePolicy::next(index, probe, entry.hashValue, capacity);
+        }
+        table[index] = move(entry);
+        return index;
+    }
+
+    // Recomputes the live bitmap from the entries, one bitmap word per iteration.
+    void rebuildLiveMask() {
+        for (int word = 0; word < static_cast<int>(liveMask.size()); ++word) {
+            uint64_t bits = 0;
+            int last = min(capacity, (word + 1) << 6);
+            for (int index = word << 6; index < last; ++index) {
+                if (table[index].occupied && table[index].active) {
+                    bits |= uint64_t(1) << (index & 63);
+                }
+            }
+            liveMask[word] = bits;
+        }
+    }
+
+    // Runs the erase/compaction sweep over the slots strictly between two empty slots
+    // (first and stop, walking forward and wrapping). Matching entries and tombstones are
+    // cleared, and every live entry after a cleared slot in the same probe run is moved back
+    // towards its home slot, so lookups never need to step over a tombstone afterwards.
+    // Probe runs never cross an empty slot, so disjoint segments can be swept in parallel.
+    // Returns the number of erased entries and the number of dropped tombstones. The live bitmap
+    // is only updated when keepMask is set; parallel sweeps rebuild it afterwards instead, since
+    // neighbouring segments can share a bitmap word.
+    template<typename Predicate>
+    pair<int, int> sweepSegment(int first, int stop, Predicate& pred, bool keepMask) {
+        int erased = 0;
+        int dropped = 0;
+        bool holeInRun = false;  // Whether a slot earlier in the current probe run was cleared
+        for (int index = (first + 1) % capacity; index != stop; index = (index + 1) % capacity) {
+            Entry& entry = table[index];
+            if (!entry.occupied) {
+                holeInRun = false;  // An empty slot ends the probe run.
+            }
+            else if (!entry.active) {
+                entry = Entry();    // Drop the tombstone.
+                dropped++;
+                holeInRun = true;
+            }
+            else if (pred(static_cast<const K&>(entry.key), entry.value)) {
+                entry = Entry();
+                if (keepMask) {
+                    markDead(index);
+                }
+                erased++;
+                holeInRun = true;
+            }
+            else if (holeInRun) {
+                Entry moved = move(entry);
+                entry = Entry();
+                int target = placeEntry(move(moved));  // Lands at or before its old slot.
+                if (keepMask) {
+                    markDead(index);
+                    markLive(target);
+                }
+            }
+        }
+        return make_pair(erased, dropped);
+    }
+
+public:
+    // Constructor to initialize the hash table with a specified capacity.
+    HashTableLinearProbing(int capacity = 15000) : capacity(capacity), size(0), tombstones(0), table(capacity), liveMask((capacity + 63) / 64) {}
+
+    // Forward iterator over the active entries, visited in slot order.
+    // Dereferencing yields a (key, value) pair of references, so structured bindings work.
+    template<bool IsConst>
+    class SlotIterator {
+    public:
+        using owner_type = typename conditional<IsConst, const HashTableLinearProbing, HashTableLinearProbing>::type;
+        using iterator_category = forward_iterator_tag;
+        using value_type = pair<const K, V>;
+        using difference_type = ptrdiff_t;
+        using reference = pair<const K&, typename conditional<IsConst, const V&, V&>::type>;
+        using pointer = void;
+
+        SlotIterator() : owner(nullptr), index(0) {}
+        SlotIterator(owner_type* owner, int index) : owner(owner), index(index) {}
+
+        // Allows an iterator to be converted into a const_iterator.
+        operator SlotIterator<true>() const { return SlotIterator<true>(owner, index); }
+
+        reference operator*() const {
+            auto& entry = owner->table[index];
+            return reference(entry.key, entry.value);
+        }
+
+        SlotIterator& operator++() {
+            index = owner->nextLive(index + 1);
+            return *this;
+        }
+
+        SlotIterator operator++(int) {
+            SlotIterator previous = *this;
+            ++(*this);
+            return previous;
+        }
+
+        bool operator==(const SlotIterator& other) const { return index == other.index; }
+        bool operator!=(const SlotIterator& other) const { return index != other.index; }
+
+        // The slot the iterator currently points at.
+        int slot() const { return index; }
+
+    private:
+        owner_type* owner;
+        int index;
+    };
+
+    using iterator = SlotIterator<false>;
+    using const_iterator = SlotIterator<true>;
+
+    iterator begin() { return iterator(this, nextLive(0)); }
+    iterator end() { return iterator(this, capacity); }
+    const_iterator begin() const { return const_iterator(this, nextLive(0)); }
+    const_iterator end() const { return const_iterator(this, capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    // Returns an iterator to the first active entry at or after the given slot, or end().
+    iterator iteratorAt(int slot) { return iterator(this, nextLive(max(0, slot))); }
+
+    // Returns the number of active entries in the table.
+    int getSize() const { return size; }
+
+    // Returns the number of slots in the table.
+    int getCapacity() const { return capacity; }
+
+    // Calls fn(key, value) for every active entry in slot order.
+    // The bitmap is consumed a word at a time and entries further ahead are prefetched,
+    // which keeps the memory pipeline busy when the value type spans several cache lines.
+    template<typename Function>
+    void for_each(Function fn) {
+        scanWords(*this, 0, static_cast<int>(liveMask.size()), fn);
+    }
+
+    // Const version of for_each; fn receives read-only references.
+    template<typename Function>
+    void for_each(Function fn) const {
+        scanWords(*this, 0, static_cast<int>(liveMask.size()), fn);
+    }
+
+    // Calls fn(key, value) for every active entry using several threads.
+    // The slot array is cut into chunks of whole bitmap words (4096 slots) and the workers pull
+    // chunks until none are left; two workers can only share the cache line at a chunk edge.
+    // fn must be safe to call concurrently for different entries.
+    template<typename Function>
+    void parallel_for_each(Function fn, int threads = defaultThreadCount()) {
+        runChunks(threads, [this, &fn](int firstWord, int lastWord, int) {
+            scanWords(*this, firstWord, lastWord, fn);
+        });
+    }
+
+    // Maps every active entry with map(key, value) and folds the results together with combine.
+    // Each chunk is reduced into a local on its own worker and stored once when it is done, so
+    // workers do not write to shared cache lines per entry. The partial results are combined in
+    // slot order, so combine only has to be associative. init is combined in exactly once.
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T init, Map map, Combine combine, int threads = defaultThreadCount()) const {
+        int chunkCount = (static_cast<int>(liveMask.size()) + wordsPerChunk - 1) / wordsPerChunk;
+        vector<T> partials(chunkCount, init);
+        vector<char> hasPartial(chunkCount, 0);
+        runChunks(threads, [this, &map, &combine, &init, &partials, &hasPartial](int firstWord, int lastWord, int chunk) {
+            T partial = init;
+            bool found = false;
+            scanWords(*this, firstWord, lastWord, [&](const K& key, const V& value) {
+                if (found) {
+                    partial = combine(partial, map(key, value));
+                }
+                else {
+                    partial = map(key, value);
+                    found = true;
+                }
+            });
+            if (found) {
+                partials[chunk] = move(partial);
+                hasPartial[chunk] = 1;
+            }
+        });
+
+        T result = init;
+        for (int chunk = 0; chunk < chunkCount; ++chunk) {
+            if (hasPartial[chunk]) {
+                result = combine(result, partials[chunk]);
+            }
+        }
+        return result;
+    }
+
+#if HASH_TABLE_HAS_EXECUTION
+    // Overloads that take a standard execution policy; sequential policies run on one thread.
+    template<typename ExecutionPolicy, typename Function,
+             typename enable_if<is_execution_policy<typename decay<ExecutionPolicy>::type>::value, int>::type = 0>
+    void parallel_for_each(ExecutionPolicy&&, Function fn) {
+        parallel_for_each(fn, policyThreadCount<typename decay<ExecutionPolicy>::type>());
+    }
+
+    template<typename ExecutionPolicy, typename T, typename Map, typename Combine,
+             typename enable_if<is_execution_policy<typename decay<ExecutionPolicy>::type>::value, int>::type = 0>
+    T parallel_reduce(ExecutionPolicy&&, T init, Map map, Combine combine) const {
+        return parallel_reduce(init, map, combine, policyThreadCount<typename decay<ExecutionPolicy>::type>());
+    }
+#endif
+
+    // Method to insert a key-value pair into the hash table.
+    void insert(K key, V value) {
+        size_t hashValue = hashKey(key); // Hash the key once; the index is derived from it.
+        insertHashed(hashValue, move(key), move(value));
+    }
+
+    // Method to retrieve the value associated with a key.
+    V retrieve(K key) {
+        int index = findHashed(hashKey(key), key);
+        if (index < 0) {
+            throw runtime_error("Key not found");  // Key was not found.
+        }
+        return table[index].value;
+    }
+
+    // Returns a pointer to the value for a key, or nullptr when it is not in the table.
+    // Unlike retrieve, a missing key costs no exception.
+    V* find(const K& key) {
+        int index = findHashed(hashKey(key), key);
+        return index < 0 ? nullptr : &table[index].value;
+    }
+
+    const V* find(const K& key) const {
+        int index = findHashed(hashKey(key), key);
+        return index < 0 ? nullptr : &table[index].value;
+    }
+
+    bool contains(const K& key) const {
+        return find(key) != nullptr;
+    }
+
+    // Looks up count keys together, writing each key's value pointer (or nullptr) to results.
+    // Each group of keys is hashed and its home slots prefetched before any of them is probed,
+    // so the cache misses of a batch overlap instead of being paid one after another.
+    void findBatch(const K* keys, size_t count, const V** results) const {
+        const size_t group = 16;
+        size_t hashes[group];
+        for (size_t first = 0; first < count; first += group) {
+            size_t n = min(group, count - first);
+            for (size_t i = 0; i < n; ++i) {
+                hashes[i] = hashKey(keys[first + i]);
+                prefetchAddress(&table[indexFor(hashes[i])]);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                int index = findHashed(hashes[i], keys[first + i]);
+                results[first + i] = index < 0 ? nullptr : &table[index].value;
+            }
+        }
+    }
+
+    // Returns the value of key, inserting a value-initialised one first when the key is missing.
+    // Either way it costs one probe, and the caller updates the value in place; this is the path
+    // aggregations take. Throws overflow_error when a new key does not fit.
+    V& findOrInsert(const K& key) {
+        return table[findOrInsertHashed(hashKey(key), key)].value;
+    }
+
+    // findOrInsert for count keys, writing a pointer to each key's value to results. The home
+    // slot of the key `distance` places ahead is prefetched while the current one is probed, so
+    // every probe finds its line already on the way instead of stalling at the start of a group.
+    // The pointers stay valid until something is removed, since inserting never moves entries.
+    void findOrInsertBatch(const K* keys, size_t count, V** results) {
+        const size_t distance = 16;   // A power of two, so the ring of hashes wraps with a mask
+        size_t hashes[distance];
+        for (size_t i = 0; i < min(distance, count); ++i) {
+            hashes[i] = hashKey(keys[i]);
+            prefetchAddress(&table[indexFor(hashes[i])]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            size_t hashValue = hashes[i & (distance - 1)];
+            if (i + distance < count) {
+                size_t ahead = hashKey(keys[i + distance]);
+                hashes[i & (distance - 1)] = ahead;
+                prefetchAddress(&table[indexFor(ahead)]);
+            }
+            results[i] = &table[findOrInsertHashed(hashValue, keys[i])].value;
+        }
+    }
+
+    // Folds other into this table: keys missing here are copied, and for keys in both,
+    // combine(ourValue, theirValue) updates our value. The cached hashes are reused, so merging
+    // per-thread tables costs no rehashing.
+    template<typename Combine>
+    void mergeWith(const HashTableLinearProbing& other, Combine combine) {
+        for (int index = other.nextLive(0); index < other.capacity; index = other.nextLive(index + 1)) {
+            const Entry& entry = other.table[index];
+            int target = probeForInsert(entry.hashValue, entry.key);
+            if (isActive(target)) {
+                combine(table[target].value, static_cast<const V&>(entry.value));
+            }
+            else {
+                storeAt(target, entry.hashValue, K(entry.key), V(entry.value));
+            }
+        }
+    }
+
+    // Method to remove an entry by key.
+    bool remove(K key) {
+        int index = findHashed(hashKey(key), key);
+        if (index < 0) {
+            return false;  // The key was not found for removal.
+        }
+        deactivate(index); // Deactivate the entry.
+        compactIfNeeded();
+        return true;       // Successfully removed.
+    }
+
+    // A detached entry, produced by extract() and consumed by insert(NodeHandle&&).
+    // The key and value are moved rather than copied, and the key's hash travels with them.
+    struct NodeHandle {
+        K key;
+        V value;
+        size_t hashValue = 0;
+        bool present = false;
+
+        bool empty() const { return !present; }
+        explicit operator bool() const { return present; }
+    };
+
+    // Removes the entry for a key and hands its key and value over without copying them.
+    // Returns an empty handle when the key is not in the table.
+    NodeHandle extract(const K& key) {
+        NodeHandle node;
+        int index = findHashed(hashKey(key), key);
+        if (index >= 0) {
+            node.key = move(table[index].key);
+            node.value = move(table[index].value);
+            node.hashValue = table[index].hashValue;
+            node.present = true;
+            deactivate(index);
+            compactIfNeeded();
+        }
+        return node;
+    }
+
+    // Inserts an extracted entry, overwriting any existing value for its key like insert() does.
+    // The cached hash is reused. Returns false (and does nothing) for an empty handle.
+    bool insert(NodeHandle&& node) {
+        if (!node.present) {
+            return false;
+        }
+        insertHashed(node.hashValue, move(node.key), move(node.value));
+        node.present = false;
+        return true;
+    }
+
+    // Copies every entry of other whose key is not already present into this table and returns
+    // how many were added; existing values win. Entries are read in other's slot order, which is
+    // a sequential walk of its memory, and their cached hashes are reused instead of rehashing.
+    // Both tables use hash<K>, so the cached hashes are always valid here.
+    int merge(const HashTableLinearProbing& other) {
+        int added = 0;
+        for (int index = other.nextLive(0); index < other.capacity; index = other.nextLive(index + 1)) {
+            const Entry& source = other.table[index];
+            int target = probeForInsert(source.hashValue, source.key);
+            if (!isActive(target)) {
+                K key = source.key;
+                V value = source.value;
+                storeAt(target, source.hashValue, move(key), move(value));
+                added++;
+            }
+        }
+        return added;
+    }
+
+    // Like merge(const&), but moves keys and values out of other instead of copying them.
+    // other is left empty afterwards; entries whose key was already present here are dropped.
+    int merge(HashTableLinearProbing&& other) {
+        int added = 0;
+        for (int index = other.nextLive(0); index < other.capacity; index = other.nextLive(index + 1)) {
+            Entry& source = other.table[index];
+            int target = probeForInsert(source.hashValue, source.key);
+            if (!isActive(target)) {
+                storeAt(target, source.hashValue, move(source.key), move(source.value));
+                added++;
+            }
+        }
+        other.clear();
+        return added;
+    }
+
+    // Removes every key that is present in other and returns how many were removed.
+    // other's cached hashes are reused, so no key is rehashed.
+    int difference(const HashTableLinearProbing& other) {
+        int removed = 0;
+        for (int index = other.nextLive(0); index < other.capacity; index = other.nextLive(index + 1)) {
+            const Entry& source = other.table[index];
+            int found = findHashed(source.hashValue, source.key);
+            if (found >= 0) {
+                deactivate(found);
+                removed++;
+            }
+        }
+        compactIfNeeded();
+        return removed;
+    }
+
+    // Removes all entries (and tombstones) while keeping the capacity.
+    void clear() {
+        for (auto& entry : table) {
+            entry = Entry();
+        }
+        fill(liveMask.begin(), liveMask.end(), 0);
+        size = 0;
+        tombstones = 0;
+        purgeCursor = -1;
+    }
+
+    // Returns the number of deleted entries still occupying slots.
+    int getTombstoneCount() const { return tombstones; }
+
+    // Rebuilds the table with just enough slots for the active entries at targetLoad, dropping all
+    // tombstones and releasing the old slot array. Cached hashes are reused, so no key is rehashed.
+    // The new table keeps at least minCapacity slots. If that would not make the table smaller,
+    // the tombstones are purged in place instead.
+    void shrink_to_fit(double targetLoad = shrinkTargetLoad, int minCapacity = 1) {
+        int newCapacity = shrunkCapacity(targetLoad, minCapacity);
+        if (newCapacity >= capacity) {
+            erase_if([](const K&, const V&) { return false; }, defaultThreadCount());
+            return;
+        }
+
+        vector<Entry> oldTable(newCapacity);
+        oldTable.swap(table);
+        capacity = newCapacity;
+        liveMask.assign((newCapacity + 63) / 64, 0);
+        for (auto& entry : oldTable) {
+            if (entry.occupied && entry.active) {
+                markLive(placeEntry(move(entry)));
+            }
+        }
+        tombstones = 0;
+        purgeCursor = -1;
+        // oldTable goes out of scope here; a large block goes straight back to the OS with it.
+    }
+
+    // Sets up automatic compaction after removals.
+    // shrinkBelow: rebuild into a smaller table (at load 0.5) once size/capacity drops below this.
+    //              Keep it well under 0.5 so the table does not shrink again right away; 0 disables.
+    // purgeAbove:  purge tombstones once they take up more than this fraction of the slots; 0 disables.
+    // incremental: spread the purge over the following removals, purgeStepSlots slots at a time,
+    //              instead of pausing for one full sweep.
+    // minCapacity: automatic shrinking never goes below this many slots.
+    // Note the table does not grow again on its own, so only shrink tables that are done growing.
+    void setCompactionPolicy(double shrinkBelow, double purgeAbove, bool incremental = false, int minCapacity = 16) {
+        shrinkBelowLoad = shrinkBelow;
+        purgeAboveTombstones = purgeAbove;
+        incrementalPurge = incremental;
+        minimumCapacity = minCapacity;
+    }
+
+    // Removes every entry for which pred(key, value) returns true and returns how many were removed.
+    // Instead of leaving tombstones like remove(), this walks the slot array once and compacts
+    // each affected probe run in place, so the table holds no tombstones afterwards.
+    // (Tables with a non-contiguous probe policy are rebuilt without the removed entries instead.)
+    // With threads above 1, large tables are split at empty slots and the pieces are swept
+    // concurrently, so pred must then be safe to call from several threads at once. The tombstone
+    // sweeps of the compaction policy always do this, since their predicate is trivially safe.
+    template<typename Predicate>
+    int erase_if(Predicate pred, int threads = 1) {
+        // Every sweep has to start at an empty slot; collect roughly evenly spaced ones.
+        // Probe sequences that jump around cannot be compacted run by run, so those tables are rebuilt.
+        int segmentCount = capacity >= parallelEraseThreshold ? max(1, threads) * 4 : 1;
+        vector<int> boundaries;
+        for (int segment = 0; segment < segmentCount && ProbePolicy::contiguous; ++segment) {
+            int index = static_cast<int>(static_cast<long long>(capacity) * segment / segmentCount);
+            int scanned = 0;
+            while (scanned < capacity && table[index].occupied) {
+                index = (index + 1) % capacity;
+                scanned++;
+            }
+            if (scanned == capacity) {
+                break;  // No empty slot at all.
+            }
+            if (boundaries.empty() || (index != boundaries.back() && index != boundaries.front())) {
+                boundaries.push_back(index);
+            }
+        }
+
+        int erased = 0;
+        if (boundaries.empty()) {
+            // Every slot is occupied, so there is nowhere to start a run (or the probe policy is not
+            // contiguous); rebuild the table instead.
+            vector<Entry> kept;
+            for (auto& entry : table) {
+                if (entry.occupied && entry.active) {
+                    if (pred(static_cast<const K&>(entry.key), entry.value)) {
+                        erased++;
+                    }
+                    else {
+                        kept.push_back(move(entry));
+                    }
+                }
+                entry = Entry();
+            }
+            for (auto& entry : kept) {
+                placeEntry(move(entry));
+            }
+        }
+        else {
+            // The boundaries are found in increasing order apart from a possible wrap at the end.
+            sort(boundaries.begin(), boundaries.end());
+            int pieces = static_cast<int>(boundaries.size());
+            vector<int> erasedPerPiece(pieces, 0);
+            auto sweepPiece = [&](int piece) {
+                erasedPerPiece[piece] = sweepSegment(boundaries[piece], boundaries[(piece + 1) % pieces], pred, false).first;
+            };
+            if (pieces == 1) {
+                // A single empty slot both starts and ends the sweep, so walk the whole table.
+                erasedPerPiece[0] = sweepSegment(boundaries[0], boundaries[0], pred, false).first;
+            }
+            else {
+                atomic<int> nextPiece(0);
+                auto worker = [&]() {
+                    for (int piece = nextPiece++; piece < pieces; piece = nextPiece++) {
+                        sweepPiece(piece);
+                    }
+                };
+                vector<thread> pool;
+                for (int i = 1; i < min(threads, pieces); ++i) {
+                    pool.emplace_back(worker);
+                }
+                worker();
+                for (auto& t : pool) {
+                    t.join();
+                }
+            }
+            for (int count : erasedPerPiece) {
+                erased += count;
+            }
+        }
+
+        size -= erased;
+        tombstones = 0;
+        purgeCursor = -1;   // Any incremental purge in progress is complete now.
+        rebuildLiveMask();
+        return erased;
+    }
+
+    // Writes the table to a snapshot: the probe policy and capacity, then every occupied slot
+    // (active entries and tombstones, which probe runs still pass through) with its cached hash.
+    // Slots go out in slot order and are put back in the same slots, so loading does no probing.
+    void saveSnapshot(ostream& out) const {
+        writeSnapshotHeader(out, ProbingTableSnapshot);
+        writeBinary(out, ProbePolicy::id);
+        writeBinary(out, static_cast<int32_t>(capacity));
+        writeBinary(out, static_cast<int32_t>(size));
+        writeBinary(out, static_cast<int32_t>(size + tombstones));
+        for (int index = 0; index < capacity; ++index) {
+            const Entry& entry = table[index];
+            if (entry.occupied) {
+                writeBinary(out, static_cast<int32_t>(index));
+                writeBinary(out, static_cast<uint8_t>(entry.active ? 1 : 0));
+                writeBinary(out, static_cast<uint64_t>(entry.hashValue));
+                writeBinary(out, entry.key);
+                writeBinary(out, entry.value);
+            }
+        }
+    }
+
+    // Reads a table written by saveSnapshot.
+    static HashTableLinearProbing loadSnapshot(istream& in) {
+        readSnapshotHeader(in, ProbingTableSnapshot);
+        uint32_t policyId;
+        readBinary(in, policyId);
+        if (policyId != ProbePolicy::id) {
+            throw runtime_error("Snapshot was written with a different probe policy");
+        }
+        int32_t storedCapacity, storedSize, storedSlots;
+        readBinary(in, storedCapacity);
+        readBinary(in, storedSize);
+        readBinary(in, storedSlots);
+        if (storedCapacity <= 0 || storedSize < 0 || storedSlots < storedSize || storedSlots > storedCapacity) {
+            throw runtime_error("Snapshot is truncated or corrupt");
+        }
+        HashTableLinearProbing loaded(storedCapacity);
+        for (int32_t i = 0; i < storedSlots; ++i) {
+            int32_t index;
+            uint8_t active;
+            uint64_t hashValue;
+            K key;
+            V value;
+            readBinary(in, index);
+            readBinary(in, active);
+            readBinary(in, hashValue);
+            readBinary(in, key);
+            readBinary(in, value);
+            if (index < 0 || index >= storedCapacity || loaded.table[index].occupied) {
+                throw runtime_error("Snapshot is truncated or corrupt");
+            }
+            loaded.table[index] = Entry(move(key), move(value), static_cast<size_t>(hashValue));
+            if (active) {
+                loaded.markLive(index);
+                loaded.size++;
+            }
+            else {
+                loaded.table[index].active = false;
+                loaded.tombstones++;
+            }
+        }
+        if (loaded.size != storedSize) {
+            throw runtime_error("Snapshot is truncated or corrupt");
+        }
+        return loaded;
+    }
+
+    // Method to perform performance tests on the hash table operations.
+    void performTest(int numOperations) {
+        vector<string> keys(numOperations);
+        vector<int> values(numOperations);
+        random_device rd;  // Random device to seed the generator for random keys and values.
+        mt19937 eng(rd());
+        uniform_int_distribution<> distr(100000, 999999);
+
+        // Record the start time of the insert operations.
+        auto insert_start = high_resolution_clock::now();
+        for (int i = 0; i < numOperations; ++i) {
+            keys[i] = "key" + to_string(distr(eng));  // Generate random keys.
+            values[i] = distr(eng);                  // Generate random values.
+            insert(keys[i], values[i]);              // Insert them into the hash table.
+        }
+        auto insert_end = high_resolution_clock::now();  // Record the end time.
+
+        // Record the start time of the retrieve operations.
+        auto retrieve_start = high_resolution_clock::now();
+        for (int i = 0; i < numOperations; ++i) {
+            retrieve(keys[i]);  // Retrieve each key to measure performance.
+        }
+        auto retrieve_end = high_resolution_clock::now();  // Record the end time.
+
+        // Start timing the remove operations.
+        auto remove_start = high_resolution_clock::now();
+        for (int i = 0; i < numOperations; ++i) {
+            remove(keys[i]);  // Remove each key to measure performance.
+        }
+        auto remove_end = high_resolution_clock::now();  // Record the end time.
+
+        // Calculate and print the durations of each operation.
+        auto insert_duration = duration_cast<milliseconds>(insert_end - insert_start);
+        auto retrieve_duration = duration_cast<milliseconds>(retrieve_end - retrieve_start);
+        auto remove_duration = duration_cast<milliseconds>(remove_end - remove_start);
+
+        cout << "Performance for " << numOperations << " operations:" << endl;
+        cout << "Insert Duration: " << insert_duration.count() << " ms" << endl;
+        cout << "Retrieve Duration: " << retrieve_duration.count() << " ms" << endl;
+        cout << "Remove Duration: " << remove_duration.count() << " ms" << endl;
+    }
+
+    // Method to measure how fast a full table scan runs, using both the iterators and for_each.
+    void performScanTest(int numEntries) {
+        HashTableLinearProbing<string, int> scanTable(numEntries * 2);  // Keep the load factor at 0.5.
+        mt19937 eng(random_device{}());
+        uniform_int_distribution<> distr(0, 999999999);
+        for (int i = 0; i < numEntries; ++i) {
+            scanTable.insert("key" + to_string(distr(eng)), i);
+        }
+
+        const int passes = 10;  // Repeat the scan so short runs are still measurable.
+        long long checksum = 0;
+
+        auto iterator_start = high_resolution_clock::now();
+        for (int pass = 0; pass < passes; ++pass) {
+            for (auto entry : scanTable) {
+                checksum += entry.second;
+            }
+        }
+        auto iterator_end = high_resolution_clock::now();
+
+        auto for_each_start = high_resolution_clock::now();
+        for (int pass = 0; pass < passes; ++pass) {
+            scanTable.for_each([&checksum](const string&, int& value) { checksum += value; });
+        }
+        auto for_each_end = high_resolution_clock::now();
+
+        double scanned = static_cast<double>(scanTable.getSize()) * passes;
+        double iterator_seconds = duration<double>(iterator_end - iterator_start).count();
+        double for_each_seconds = duration<double>(for_each_end - for_each_start).count();
+
+        cout << "Scan performance for " << scanTable.getSize() << " entries in " << scanTable.getCapacity() << " slots:" << endl;
+        cout << "Iterator Scan: " << (iterator_seconds > 0 ? scanned / iterator_seconds : 0) << " entries/sec" << endl;
+        cout << "for_each Scan: " << (for_each_seconds > 0 ? scanned / for_each_seconds : 0) << " entries/sec" << endl;
+        cout << "Checksum: " << checksum << endl;
+    }
+
+    // Method to show how parallel_for_each and parallel_reduce scale with the number of threads.
+    void performParallelTest(int numEntries) {
+        HashTableLinearProbing<int, long long> parallelTable(numEntries + numEntries / 4);
+        mt19937 eng(random_device{}());
+        uniform_int_distribution<> distr(0, 999);
+        for (int i = 0; i < numEntries; ++i) {
+            parallelTable.insert(i, distr(eng));
+        }
+
+        int maxThreads = defaultThreadCount();
+        cout << "Parallel scan of " << parallelTable.getSize() << " entries (up to " << maxThreads << " threads):" << endl;
+        double baseline = 0;
+        for (int threads = 1; ; threads = min(threads * 2, maxThreads)) {
+            auto reduce_start = high_resolution_clock::now();
+            long long total = parallelTable.parallel_reduce(0LL,
+                [](int, long long value) { return value; },
+                [](long long a, long long b) { return a + b; }, threads);
+            auto reduce_end = high_resolution_clock::now();
+
+            auto for_each_start = high_resolution_clock::now();
+            parallelTable.parallel_for_each([](int, long long& value) { value += 1; }, threads);
+            auto for_each_end = high_resolution_clock::now();
+
+            double reduce_ms = duration<double, milli>(reduce_end - reduce_start).count();
+            double for_each_ms = duration<double, milli>(for_each_end - for_each_start).count();
+            if (threads == 1) {
+                baseline = reduce_ms;
+            }
+            cout << threads << " thread(s): reduce " << reduce_ms << " ms (speedup " << (reduce_ms > 0 ? baseline / reduce_ms : 0)
+                 << "x, sum " << total << "), for_each " << for_each_ms << " ms" << endl;
+            if (threads == maxThreads) {
+                break;
+            }
+        }
+    }
+
+    // Method to compare merge() of 16 partial tables against re-inserting their entries one by one.
+    void performMergeTest(int entriesPerTable) {
+        const int partialCount = 16;
+        mt19937 eng(random_device{}());
+        uniform_int_distribution<> distr(0, 999999999);
+        vector<HashTableLinearProbing<string, int>> partials;
+        for (int p = 0; p < partialCount; ++p) {
+            partials.emplace_back(entriesPerTable * 2);
+            for (int i = 0; i < entriesPerTable; ++i) {
+                partials.back().insert("key" + to_string(distr(eng)), i);
+            }
+        }
+        int mergedCapacity = entriesPerTable * partialCount * 2;
+
+        // Naive approach: walk every partial table and insert each entry again, rehashing its key.
+        HashTableLinearProbing<string, int> naiveTable(mergedCapacity);
+        auto naive_start = high_resolution_clock::now();
+        for (const auto& partial : partials) {
+            for (auto entry : partial) {
+                naiveTable.insert(entry.first, entry.second);
+            }
+        }
+        auto naive_end = high_resolution_clock::now();
+
+        // merge() reuses the cached hashes and walks each partial table in slot order.
+        HashTableLinearProbing<string, int> mergedTable(mergedCapacity);
+        auto merge_start = high_resolution_clock::now();
+        for (const auto& partial : partials) {
+            mergedTable.merge(partial);
+        }
+        auto merge_end = high_resolution_clock::now();
+
+        cout << "Merging " << partialCount << " tables of " << entriesPerTable << " entries:" << endl;
+        cout << "Naive Re-insertion: " << duration_cast<milliseconds>(naive_end - naive_start).count() << " ms ("
+             << naiveTable.getSize() << " entries)" << endl;
+        cout << "merge(): " << duration_cast<milliseconds>(merge_end - merge_start).count() << " ms ("
+             << mergedTable.getSize() << " entries)" << endl;
+    }
+
+    // Displays the menu for interacting with the hash table from the command line.
+    void displayMenu() {
+        cout << "HASH TABLE OPERATIONS\n";
+        cout << "1. Insert Key/Value\n";
+        cout << "2. Retrieve Value by Key\n";
+        cout << "3. Remove Key\n";
+        cout << "4. Performance Test\n";
+        cout << "5. Exit\n";
+        cout << "6. Scan Benchmark\n";
+        cout << "7. Parallel Scan Benchmark\n";
+        cout << "8. Merge Benchmark\n";
+        cout << "9. Perfect Hash Benchmark\n";
+        cout << "10. Scratch Table Benchmark\n";
+        cout << "11. Probe Policy Benchmark\n";
+        cout << "12. Table Variant Latency Benchmark\n";
+        cout << "Enter your choice: ";
+    }
+};
+
+// A read-only table built from a populated table with a minimal perfect hash function, in the
+// style of PTHash: every key maps to its own slot among exactly n slots, so a lookup is one
+// hash evaluation, one 16-bit pilot read and one probe (plus a key compare to reject missing keys).
+//
+// Keys are split into partitions of about partitionKeys keys, which are built independently and in
+// parallel. Within a partition the keys are spread over buckets of about bucketKeys keys; the buckets
+// are placed largest first, each searching for a pilot value that sends all of its keys to free
+// slots. A pilot is stored per bucket, which comes to about 16 / bucketKeys = 3.2 bits per key.
+template<typename K, typename V>
+class PerfectHashTable {
+private:
+    struct Partition {
+        uint32_t slotOffset = 0;   // First slot (and key) of the partition
+        uint32_t slotCount = 0;    // Number of keys in the partition
+        uint32_t bucketOffset = 0; // First pilot of the partition
+        uint32_t bucketCount = 0;  // Number of buckets (and pilots) in the partition
+        uint64_t seed = 0;         // Seed the partition was built with
+    };
+
+    static constexpr uint32_t partitionKeys = 10000;  // Target number of keys per partition
+    static constexpr uint32_t bucketKeys = 5;         // Average number of keys per bucket
+    static constexpr uint32_t maxPilot = 0xFFFF;      // Pilots are stored in 16 bits
+
+    vector<Partition> partitions;
+    vector<uint16_t> pilots;
+    vector<K> keys;            // Keys in slot order
+    vector<V> values;          // Values in slot order
+
+    static uint64_t hashKey(const K& key) {
+        return mixHash(hash<K>()(key));
+    }
+
+    // Maps a 32-bit value onto [0, range) without a division.
+    static uint32_t reduce(uint32_t x, uint32_t range) {
+        return static_cast<uint32_t>((static_cast<uint64_t>(x) * range) >> 32);
+    }
+
+    uint32_t partitionOf(uint64_t hashValue) const {
+        return reduce(static_cast<uint32_t>(hashValue >> 32), static_cast<uint32_t>(partitions.size()));
+    }
+
+    static uint64_t seeded(uint64_t hashValue, uint64_t seed) {
+        return mixHash(hashValue ^ seed);
+    }
+
+    static uint32_t bucketOf(uint64_t seededHash, uint32_t bucketCount) {
+        return reduce(static_cast<uint32_t>(seededHash >> 32), bucketCount);
+    }
+
+    static uint32_t slotOf(uint64_t seededHash, uint16_t pilot, uint32_t slotCount) {
+        return static_cast<uint32_t>((seededHash ^ mixHash(pilot + 1)) % slotCount);
+    }
+
+    // Finds pilots for one partition. hashes holds the partition's key hashes; on success
+    // slotsOut[i] is the slot (relative to the partition) of the i-th key.
+    static bool buildPartition(const vector<uint64_t>& hashes, uint64_t seed, uint32_t bucketCount,
+                               uint16_t* pilotsOut, vector<uint32_t>& slotsOut) {
+        uint32_t slotCount = static_cast<uint32_t>(hashes.size());
+        vector<uint64_t> seededHashes(hashes.size());
+        vector<uint32_t> bucketStart(bucketCount + 1, 0);
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            seededHashes[i] = seeded(hashes[i], seed);
+            bucketStart[bucketOf(seededHashes[i], bucketCount) + 1]++;
+        }
+        for (uint32_t b = 0; b < bucketCount; ++b) {
+            bucketStart[b + 1] += bucketStart[b];
+        }
+        vector<uint32_t> members(hashes.size());  // Key numbers grouped by bucket
+        vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (uint32_t i = 0; i < slotCount; ++i) {
+            members[fill[bucketOf(seededHashes[i], bucketCount)]++] = i;
+        }
+
+        vector<uint32_t> order(bucketCount);
+        for (uint32_t b = 0; b < bucketCount; ++b) {
+            order[b] = b;
+        }
+        stable_sort(order.begin(), order.end(), [&bucketStart](uint32_t a, uint32_t b) {
+            return bucketStart[a + 1] - bucketStart[a] > bucketStart[b + 1] - bucketStart[b];
+        });
+
+        vector<char> taken(slotCount, 0);
+        vector<uint32_t> candidate;
+        slotsOut.assign(slotCount, 0);
+        for (uint32_t bucket : order) {
+            uint32_t first = bucketStart[bucket], last = bucketStart[bucket + 1];
+            pilotsOut[bucket] = 0;
+            if (first == last) {
+                continue;
+            }
+            bool placed = false;
+            for (uint32_t pilot = 0; pilot <= maxPilot && !placed; ++pilot) {
+                candidate.clear();
+                placed = true;
+                for (uint32_t m = first; m < last && placed; ++m) {
+                    uint32_t slot = slotOf(seededHashes[members[m]], static_cast<uint16_t>(pilot), slotCount);
+                    if (taken[slot] || std::find(candidate.begin(), candidate.end(), slot) != candidate.end()) {
+                        placed = false;
+                    }
+                    candidate.push_back(slot);
+                }
+                if (placed) {
+                    pilotsOut[bucket] = static_cast<uint16_t>(pilot);
+                    for (uint32_t m = first; m < last; ++m) {
+                        taken[candidate[m - first]] = 1;
+                        slotsOut[members[m]] = candidate[m - first];
+                    }
+                }
+            }
+            if (!placed) {
+                return false;  // No 16-bit pilot works (or two keys share a hash); retry with another seed.
+            }
+        }
+        return true;
+    }
+
+public:
+    PerfectHashTable() = default;
+
+    // Builds the table from any table offering for_each(key, value), e.g. HashTableLinearProbing.
+    template<typename Table>
+    explicit PerfectHashTable(const Table& source, int threads = max(1, static_cast<int>(thread::hardware_concurrency()))) {
+        vector<K> sourceKeys;
+        vector<V> sourceValues;
+        vector<uint64_t> hashes;
+        source.for_each([&](const K& key, const V& value) {
+            sourceKeys.push_back(key);
+            sourceValues.push_back(value);
+            hashes.push_back(hashKey(key));
+        });
+        size_t n = sourceKeys.size();
+        if (n > 0xFFFFFFFFULL) {
+            throw overflow_error("Too many keys for a perfect hash table");
+        }
+        partitions.resize(max<size_t>(1, (n + partitionKeys - 1) / partitionKeys));
+
+        // Group the keys by partition.
+        vector<vector<uint32_t>> partitionMembers(partitions.size());
+        for (uint32_t i = 0; i < n; ++i) {
+            partitionMembers[partitionOf(hashes[i])].push_back(i);
+        }
+        uint32_t slotOffset = 0, bucketOffset = 0;
+        for (size_t p = 0; p < partitions.size(); ++p) {
+            uint32_t count = static_cast<uint32_t>(partitionMembers[p].size());
+            partitions[p].slotOffset = slotOffset;
+            partitions[p].slotCount = count;
+            partitions[p].bucketOffset = bucketOffset;
+            partitions[p].bucketCount = max<uint32_t>(1, (count + bucketKeys - 1) / bucketKeys);
+            slotOffset += count;
+            bucketOffset += partitions[p].bucketCount;
+        }
+        pilots.assign(bucketOffset, 0);
+        keys.resize(n);
+        values.resize(n);
+
+        // Build the partitions in parallel; each one writes only its own pilots and slots.
+        atomic<size_t> nextPartition(0);
+        auto worker = [&]() {
+            vector<uint64_t> partitionHashes;
+            vector<uint32_t> slots;
+            for (size_t p = nextPartition++; p < partitions.size(); p = nextPartition++) {
+                Partition& part = partitions[p];
+                partitionHashes.clear();
+                for (uint32_t member : partitionMembers[p]) {
+                    partitionHashes.push_back(hashes[member]);
+                }
+                uint64_t seed = p;
+                for (int attempt = 1; !buildPartition(partitionHashes, seed, part.bucketCount, &pilots[part.bucketOffset], slots); ++attempt) {
+                    if (attempt == 64) {
+                        throw runtime_error("Perfect hash construction failed; are there duplicate keys?");
+                    }
+                    seed += 0x9E3779B97F4A7C15ULL;
+                }
+                part.seed = seed;
+                for (size_t i = 0; i < slots.size(); ++i) {
+                    uint32_t member = partitionMembers[p][i];
+                    keys[part.slotOffset + slots[i]] = move(sourceKeys[member]);
+                    values[part.slotOffset + slots[i]] = move(sourceValues[member]);
+                }
+            }
+        };
+        threads = max(1, min<int>(threads, static_cast<int>(partitions.size())));
+        vector<thread> pool;
+        vector<exception_ptr> failures(threads);
+        for (int i = 0; i < threads; ++i) {
+            pool.emplace_back([&worker, &failures, i]() {
+                try {
+                    worker();
+                }
+                catch (...) {
+                    failures[i] = current_exception();
+                }
+            });
+        }
+        for (auto& t : pool) {
+            t.join();
+        }
+        for (auto& failure : failures) {
+            if (failure) {
+                rethrow_exception(failure);
+            }
+        }
+    }
+
+    // Returns the slot a key maps to. Every key of the table has its own slot; other keys map to
+    // some arbitrary slot, which the key compare in find() rejects.
+    size_t slotFor(const K& key) const {
+        uint64_t hashValue = hashKey(key);
+        const Partition& part = partitions[partitionOf(hashValue)];
+        if (part.slotCount == 0) {
+            return keys.size();
+        }
+        uint64_t seededHash = seeded(hashValue, part.seed);
+        uint16_t pilot = pilots[part.bucketOffset + bucketOf(seededHash, part.bucketCount)];
+        return part.slotOffset + slotOf(seededHash, pilot, part.slotCount);
+    }
+
+    // Returns a pointer to the value for a key, or nullptr when it is not in the table.
+    const V* find(const K& key) const {
+        size_t slot = slotFor(key);
+        return slot < keys.size() && keys[slot] == key ? &values[slot] : nullptr;
+    }
+
+    // Method to retrieve the value associated with a key.
+    V retrieve(const K& key) const {
+        const V* value = find(key);
+        if (value == nullptr) {
+            throw runtime_error("Key not found");
+        }
+        return *value;
+    }
+
+    int getSize() const { return static_cast<int>(keys.size()); }
+
+    // Bits per key spent on the hash function itself (pilots and partition records).
+    double bitsPerKey() const {
+        if (keys.empty()) {
+            return 0;
+        }
+        return (pilots.size() * sizeof(uint16_t) + partitions.size() * sizeof(Partition)) * 8.0 / keys.size();
+    }
+
+    // Calls fn(key, value) for every entry in slot order.
+    template<typename Function>
+    void for_each(Function fn) const {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            fn(keys[i], values[i]);
+        }
+    }
+
+    // Writes the table to a snapshot (same header and encoding as HashTableLinearProbing snapshots).
+    void saveSnapshot(ostream& out) const {
+        writeSnapshotHeader(out, PerfectHashSnapshot);
+        writeBinary(out, static_cast<uint64_t>(partitions.size()));
+        for (const Partition& part : partitions) {
+            writeBinary(out, part.slotOffset);
+            writeBinary(out, part.slotCount);
+            writeBinary(out, part.bucketOffset);
+            writeBinary(out, part.bucketCount);
+            writeBinary(out, part.seed);
+        }
+        writeBinary(out, static_cast<uint64_t>(pilots.size()));
+        out.write(reinterpret_cast<const char*>(pilots.data()), pilots.size() * sizeof(uint16_t));
+        writeBinary(out, static_cast<uint64_t>(keys.size()));
+        for (size_t i = 0; i < keys.size(); ++i) {
+            writeBinary(out, keys[i]);
+            writeBinary(out, values[i]);
+        }
+    }
+
+    // Reads a table written by saveSnapshot.
+    static PerfectHashTable loadSnapshot(istream& in) {
+        readSnapshotHeader(in, PerfectHashSnapshot);
+        PerfectHashTable loaded;
+        uint64_t count;
+        readBinary(in, count);
+        if (count == 0) {
+            throw runtime_error("Snapshot is truncated or corrupt");
+        }
+        // Partitions must tile the slots and pilots in order, as the constructor lays them out.
+        // Reading them one at a time means a corrupt count runs into the end of the stream
+        // instead of allocating whatever it says.
+        uint64_t slotTotal = 0, bucketTotal = 0;
+        for (uint64_t p = 0; p < count; ++p) {
+            Partition part;
+            readBinary(in, part.slotOffset);
+            readBinary(in, part.slotCount);
+            readBinary(in, part.bucketOffset);
+            readBinary(in, part.bucketCount);
+            readBinary(in, part.seed);
+            if (part.slotOffset != slotTotal || part.bucketOffset != bucketTotal || part.bucketCount == 0) {
+                throw runtime_error("Snapshot is truncated or corrupt");
+            }
+            slotTotal += part.slotCount;
+            bucketTotal += part.bucketCount;
+            if (slotTotal > 0xFFFFFFFFULL || bucketTotal > 0xFFFFFFFFULL) {
+                throw runtime_error("Snapshot is truncated or corrupt");
+            }
+            loaded.partitions.push_back(part);
+        }
+        readBinary(in, count);
+        if (count != bucketTotal) {
+            throw runtime_error("Snapshot is truncated or corrupt");
+        }
+        loaded.pilots.resize(count);
+        if (!in.read(reinterpret_cast<char*>(loaded.pilots.data()), count * sizeof(uint16_t))) {
+            throw runtime_error("Snapshot is truncated or corrupt");
+        }
+        readBinary(in, count);
+        if (count != slotTotal) {
+            throw runtime_error("Snapshot is truncated or corrupt");
+        }
+        loaded.keys.resize(count);
+        loaded.values.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            readBinary(in, loaded.keys[i]);
+            readBinary(in, loaded.values[i]);
+        }
+        return loaded;
+    }
+};
+
+// A key type whose hash ignores the key, so any two keys collide. performPerfectHashTest uses it
+// to check that a build which can never succeed fails instead of retrying forever.
+struct CollidingKey {
+    int id = 0;
+    bool operator==(const CollidingKey& other) const { return id == other.id; }
+    bool operator!=(const CollidingKey& other) const { return id != other.id; }
+};
+
+namespace std {
+template<>
+struct hash<CollidingKey> {
+    size_t operator()(const CollidingKey&) const { return 42; }
+};
+}
+
+// Compares lookup latency and memory of a probing table against the perfect hash table built from it.
+inline void performPerfectHashTest(int numEntries) {
+    HashTableLinearProbing<string, int> probingTable(numEntries * 2);  // Load factor 0.5
+    mt19937 eng(random_device{}());
+    uniform_int_distribution<> distr(0, 999999999);
+    vector<string> keys;
+    for (int i = 0; i < numEntries; ++i) {
+        keys.push_back("key" + to_string(distr(eng)));
+        probingTable.insert(keys.back(), i);
+    }
+    shuffle(keys.begin(), keys.end(), eng);
+
+    auto build_start = high_resolution_clock::now();
+    PerfectHashTable<string, int> perfectTable(probingTable);
+    auto build_end = high_resolution_clock::now();
+
+    long long checksum = 0;
+    auto probing_start = high_resolution_clock::now();
+    for (const string& key : keys) {
+        checksum += probingTable.retrieve(key);
+    }
+    auto probing_end = high_resolution_clock::now();
+    auto perfect_start = high_resolution_clock::now();
+    for (const string& key : keys) {
+        checksum -= perfectTable.retrieve(key);
+    }
+    auto perfect_end = high_resolution_clock::now();
+
+    // Slot memory: each probing slot holds key, value, flags and cached hash; the perfect table
+    // holds exactly one key and value per entry plus its pilots.
+    double probingBytes = probingTable.getCapacity() * (sizeof(string) + sizeof(int) + 2 + sizeof(size_t)) + probingTable.getCapacity() / 8.0;
+    double perfectBytes = perfectTable.getSize() * (sizeof(string) + sizeof(int)) + perfectTable.bitsPerKey() * perfectTable.getSize() / 8;
+    double lookups = keys.empty() ? 1 : static_cast<double>(keys.size());
+
+    cout << "Perfect hash table for " << perfectTable.getSize() << " keys:" << endl;
+    cout << "Build Duration: " << duration_cast<milliseconds>(build_end - build_start).count() << " ms ("
+         << perfectTable.bitsPerKey() << " bits/key)" << endl;
+    cout << "Probing Lookup: " << duration<double, nano>(probing_end - probing_start).count() / lookups << " ns, "
+         << probingBytes / (1024 * 1024) << " MB of slots" << endl;
+    cout << "Perfect Lookup: " << duration<double, nano>(perfect_end - perfect_start).count() / lookups << " ns, "
+         << perfectBytes / (1024 * 1024) << " MB of slots" << endl;
+    cout << "Checksum: " << checksum << endl;
+
+    HashTableLinearProbing<CollidingKey, int> collidingTable(4);
+    collidingTable.insert(CollidingKey{ 1 }, 1);
+    collidingTable.insert(CollidingKey{ 2 }, 2);
+    try {
+        PerfectHashTable<CollidingKey, int> impossible(collidingTable);
+        cout << "Colliding keys: built a table, which should not be possible" << endl;
+    }
+    catch (const runtime_error& e) {
+        cout << "Colliding keys: " << e.what() << endl;
+    }
+}
+
+// Measures one probe policy at several load factors: inserts, successful lookups and failed
+// lookups, in nanoseconds per operation. Used by performProbeTest for every policy.
+template<typename ProbePolicy>
+void benchmarkProbePolicy(const string& name, int capacity, const vector<int>& keys, const vector<int>& missingKeys) {
+    const double loadFactors[] = { 0.5, 0.7, 0.8, 0.9, 0.95 };
+    cout << name << ":" << endl;
+    for (double load : loadFactors) {
+        int count = min(static_cast<int>(keys.size()), static_cast<int>(capacity * load));
+        HashTableLinearProbing<int, int, ProbePolicy> table(capacity);
+        long long checksum = 0;
+
+        auto insert_start = high_resolution_clock::now();
+        try {
+            for (int i = 0; i < count; ++i) {
+                table.insert(keys[i], i);
+            }
+        }
+        catch (const overflow_error&) {
+            cout << "  load " << load << ": probe sequence could not find a free slot" << endl;
+            continue;
+        }
+        auto insert_end = high_resolution_clock::now();
+
+        auto hit_start = high_resolution_clock::now();
+        for (int i = 0; i < count; ++i) {
+            checksum += table.retrieve(keys[i]);
+        }
+        auto hit_end = high_resolution_clock::now();
+
+        auto miss_start = high_resolution_clock::now();
+        for (int i = 0; i < count; ++i) {
+            checksum += table.contains(missingKeys[i]) ? 1 : 0;  // find() avoids timing exception handling.
+        }
+        auto miss_end = high_resolution_clock::now();
+
+        auto perOp = [count](high_resolution_clock::time_point start, high_resolution_clock::time_point end) {
+            return count > 0 ? duration<double, nano>(end - start).count() / count : 0.0;
+        };
+        cout << "  load " << load << ": insert " << perOp(insert_start, insert_end) << " ns, hit "
+             << perOp(hit_start, hit_end) << " ns, miss " << perOp(miss_start, miss_end) << " ns (checksum "
+             << checksum << ")" << endl;
+    }
+}
+
+// Method to compare the probe policies on the same keys with one harness.
+// The capacity is a power of two so that quadratic probing reaches every slot.
+inline void performProbeTest(int capacity) {
+    int powerOfTwo = nextPowerOfTwo(capacity);
+    mt19937 eng(random_device{}());
+    vector<int> keys(powerOfTwo), missingKeys(powerOfTwo);
+    for (int i = 0; i < powerOfTwo; ++i) {
+        keys[i] = static_cast<int>(eng() & 0x7FFFFFFE);             // Even keys are stored...
+        missingKeys[i] = static_cast<int>(eng() & 0x7FFFFFFE) | 1;  // ...odd keys are never stored.
+    }
+
+    cout << "Probe policies with " << powerOfTwo << " slots:" << endl;
+    benchmarkProbePolicy<LinearProbe>("Linear", powerOfTwo, keys, missingKeys);
+    benchmarkProbePolicy<QuadraticProbe>("Quadratic", powerOfTwo, keys, missingKeys);
+    benchmarkProbePolicy<DoubleHashProbe>("Double Hashing", powerOfTwo, keys, missingKeys);
+    benchmarkProbePolicy<BucketizedProbe>("Bucketized", powerOfTwo, keys, missingKeys);
+}
+
+// A fixed-capacity linear probing table whose slots live inline in a std::array, so it never
+// allocates and can sit on the stack or inside another object (per-request scratch maps).
+// Slot state is kept in a separate array of control bytes and keys and values are only constructed
+// when a slot is filled, so creating an empty table just clears N bytes.
+// N must be a power of two; indexes are taken with a mask of the mixed hash instead of a modulo.
+// The API and behaviour match HashTableLinearProbing: insert overwrites, retrieve throws for a
+// missing key, remove leaves a tombstone, and insert throws overflow_error when the table is full.
+template<typename K, typename V, size_t N>
+class StaticHashTable {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "StaticHashTable capacity must be a power of two");
+
+private:
+    enum SlotState : uint8_t {
+        EmptySlot = 0,     // Never used since the last clear
+        LiveSlot = 1,      // Holds an active entry
+        DeletedSlot = 2    // Tombstone; the key is kept so probing can continue past it
+    };
+
+    struct Entry {
+        K key;                // The key of the entry
+        V value;              // The value associated with the key
+        size_t hashValue;     // Full hash of the key
+    };
+
+    array<uint8_t, N> control{};                          // SlotState of every slot
+    typename aligned_storage<sizeof(Entry), alignof(Entry)>::type slots[N]; // Raw storage for the entries
+    int size = 0;                                         // Current number of active entries
+
+    Entry& slot(size_t index) { return *reinterpret_cast<Entry*>(&slots[index]); }
+    const Entry& slot(size_t index) const { return *reinterpret_cast<const Entry*>(&slots[index]); }
+
+    static size_t hashKey(const K& key) {
+        return static_cast<size_t>(mixHash(hash<K>()(key)));
+    }
+
+    // Returns the slot holding the active entry for a key, or -1.
+    int findHashed(size_t hashValue, const K& key) const {
+        size_t index = hashValue & (N - 1);
+        for (size_t probes = 0; probes < N && control[index] != EmptySlot; ++probes) {
+            if (control[index] == LiveSlot && slot(index).hashValue == hashValue && slot(index).key == key) {
+                return static_cast<int>(index);
+            }
+            index = (index + 1) & (N - 1);
+        }
+        return -1;
+    }
+
+    // Destroys the entry in a slot and marks the slot empty.
+    void destroySlot(size_t index) {
+        slot(index).~Entry();
+        control[index] = EmptySlot;
+    }
+
+    // Moves the entry in slot `from` into the first empty slot of its probe sequence.
+    // The entry may end up back in its own slot.
+    void reseat(size_t from) {
+        Entry moved(move(slot(from)));
+        destroySlot(from);
+        size_t index = moved.hashValue & (N - 1);
+        while (control[index] != EmptySlot) {
+            index = (index + 1) & (N - 1);
+        }
+        new (&slots[index]) Entry(move(moved));
+        control[index] = LiveSlot;
+    }
+
+    void copyFrom(const StaticHashTable& other) {
+        for (size_t index = 0; index < N; ++index) {
+            if (other.control[index] != EmptySlot) {
+                new (&slots[index]) Entry(other.slot(index));
+            }
+        }
+        control = other.control;
+        size = other.size;
+    }
+
+public:
+    StaticHashTable() = default;
+    StaticHashTable(const StaticHashTable& other) { copyFrom(other); }
+
+    StaticHashTable& operator=(const StaticHashTable& other) {
+        if (this != &other) {
+            clear();
+            copyFrom(other);
+        }
+        return *this;
+    }
+
+    ~StaticHashTable() { clear(); }
+
+    // Forward iterator over the active entries, yielding (key, value) reference pairs like
+    // HashTableLinearProbing's iterators.
+    template<bool IsConst>
+    class SlotIterator {
+    public:
+        using owner_type = typename conditional<IsConst, const StaticHashTable, StaticHashTable>::type;
+        using iterator_category = forward_iterator_tag;
+        using value_type = pair<const K, V>;
+        using difference_type = ptrdiff_t;
+        using reference = pair<const K&, typename conditional<IsConst, const V&, V&>::type>;
+        using pointer = void;
+
+        SlotIterator() : owner(nullptr), index(N) {}
+        SlotIterator(owner_type* owner, size_t index) : owner(owner), index(index) { skipFree(); }
+
+        reference operator*() const {
+            auto& entry = owner->slot(index);
+            return reference(entry.key, entry.value);
+        }
+
+        SlotIterator& operator++() {
+            ++index;
+            skipFree();
+            return *this;
+        }
+
+        SlotIterator operator++(int) {
+            SlotIterator previous = *this;
+            ++(*this);
+            return previous;
+        }
+
+        bool operator==(const SlotIterator& other) const { return index == other.index; }
+        bool operator!=(const SlotIterator& other) const { return index != other.index; }
+
+    private:
+        void skipFree() {
+            while (index < N && owner->control[index] != LiveSlot) {
+                ++index;
+            }
+        }
+
+        owner_type* owner;
+        size_t index;
+    };
+
+    using iterator = SlotIterator<false>;
+    using const_iterator = SlotIterator<true>;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, N); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, N); }
+
+    int getSize() const { return size; }
+    static constexpr int getCapacity() { return static_cast<int>(N); }
+
+    // Method to insert a key-value pair into the hash table.
+    void insert(K key, V value) {
+        size_t hashValue = hashKey(key);
+        size_t index = hashValue & (N - 1);
+        size_t probes = 0;
+
+        // Keep probing linearly until an empty spot or the key's own slot is found.
+        while (control[index] != EmptySlot && (slot(index).hashValue != hashValue || slot(index).key != key)) {
+            index = (index + 1) & (N - 1);
+            if (++probes == N) {
+                throw overflow_error("Hash table is full");
+            }
+        }
+
+        if (control[index] == EmptySlot) {
+            new (&slots[index]) Entry{ move(key), move(value), hashValue };
+        }
+        else {
+            slot(index).value = move(value);  // Overwrite, or revive the key's tombstone.
+        }
+        if (control[index] != LiveSlot) {
+            size++;
+        }
+        control[index] = LiveSlot;
+    }
+
+    // Method to retrieve the value associated with a key.
+    V retrieve(const K& key) const {
+        int index = findHashed(hashKey(key), key);
+        if (index < 0) {
+            throw runtime_error("Key not found");
+        }
+        return slot(index).value;
+    }
+
+    // Returns a pointer to the value for a key, or nullptr when it is not present.
+    V* find(const K& key) {
+        int index = findHashed(hashKey(key), key);
+        return index < 0 ? nullptr : &slot(index).value;
+    }
+
+    // Method to remove an entry by key.
+    bool remove(const K& key) {
+        int index = findHashed(hashKey(key), key);
+        if (index < 0) {
+            return false;
+        }
+        control[index] = DeletedSlot;  // Leave a tombstone so later entries stay reachable.
+        size--;
+        return true;
+    }
+
+    // Calls fn(key, value) for every active entry in slot order.
+    template<typename Function>
+    void for_each(Function fn) {
+        for (size_t index = 0; index < N; ++index) {
+            if (control[index] == LiveSlot) {
+                fn(static_cast<const K&>(slot(index).key), slot(index).value);
+            }
+        }
+    }
+
+    // Removes all entries and tombstones.
+    void clear() {
+        if (!is_trivially_destructible<Entry>::value) {
+            for (size_t index = 0; index < N; ++index) {
+                if (control[index] != EmptySlot) {
+                    slot(index).~Entry();
+                }
+            }
+        }
+        control.fill(EmptySlot);
+        size = 0;
+    }
+
+    // Removes every entry matching pred(key, value) and returns how many were removed, compacting
+    // the probe runs in one sweep like HashTableLinearProbing::erase_if. A completely full table has
+    // no empty slot to start the sweep from, so there the matches are just turned into tombstones.
+    template<typename Predicate>
+    int erase_if(Predicate pred) {
+        size_t start = 0;
+        while (start < N && control[start] != EmptySlot) {
+            ++start;
+        }
+
+        int erased = 0;
+        if (start == N) {
+            for (size_t index = 0; index < N; ++index) {
+                if (control[index] == LiveSlot && pred(static_cast<const K&>(slot(index).key), slot(index).value)) {
+                    control[index] = DeletedSlot;
+                    erased++;
+                }
+            }
+            size -= erased;
+            return erased;
+        }
+
+        bool holeInRun = false;
+        for (size_t index = (start + 1) & (N - 1); index != start; index = (index + 1) & (N - 1)) {
+            if (control[index] == EmptySlot) {
+                holeInRun = false;
+            }
+            else if (control[index] == DeletedSlot) {
+                destroySlot(index);
+                holeInRun = true;
+            }
+            else if (pred(static_cast<const K&>(slot(index).key), slot(index).value)) {
+                destroySlot(index);
+                erased++;
+                holeInRun = true;
+            }
+            else if (holeInRun) {
+                reseat(index);  // Lands at or before its old slot.
+            }
+        }
+        size -= erased;
+        return erased;
+    }
+};
+
+// Compares per-request scratch maps on the heap (HashTableLinearProbing) and inline (StaticHashTable).
+inline void performScratchTableTest(int numRequests) {
+    const int entriesPerRequest = 200;
+    mt19937 eng(random_device{}());
+    vector<int> keys(entriesPerRequest * 64);  // Random keys, reused across requests
+    for (int& key : keys) {
+        key = static_cast<int>(eng());
+    }
+    long long checksum = 0;
+
+    auto heap_start = high_resolution_clock::now();
+    for (int request = 0; request < numRequests; ++request) {
+        const int* requestKeys = &keys[(request % 64) * entriesPerRequest];
+        HashTableLinearProbing<int, int> scratch(512);
+        for (int i = 0; i < entriesPerRequest; ++i) {
+            scratch.insert(requestKeys[i], i);
+        }
+        checksum += scratch.retrieve(requestKeys[request % entriesPerRequest]);
+    }
+    auto heap_end = high_resolution_clock::now();
+
+    auto static_start = high_resolution_clock::now();
+    for (int request = 0; request < numRequests; ++request) {
+        const int* requestKeys = &keys[(request % 64) * entriesPerRequest];
+        StaticHashTable<int, int, 512> scratch;
+        for (int i = 0; i < entriesPerRequest; ++i) {
+            scratch.insert(requestKeys[i], i);
+        }
+        checksum -= scratch.retrieve(requestKeys[request % entriesPerRequest]);
+    }
+    auto static_end = high_resolution_clock::now();
+
+    cout << "Scratch maps for " << numRequests << " requests of " << entriesPerRequest << " entries:" << endl;
+    cout << "HashTableLinearProbing: " << duration_cast<milliseconds>(heap_end - heap_start).count() << " ms" << endl;
+    cout << "StaticHashTable: " << duration_cast<milliseconds>(static_end - static_start).count() << " ms" << endl;
+    cout << "Checksum: " << checksum << endl;
+}
+
+// A bucketized cuckoo hash table with the same API as HashTableLinearProbing, for paths that
+// need a bounded lookup cost. Every key lives in one of two buckets of 4 slots (or in a small
+// stash), so retrieve checks at most 8 slots. Each bucket starts with the 4 one-byte tags of its
+// slots, ahead of its entries, so a miss reads one cache line of each of its two buckets and only
+// touches an entry when its tag matches. Inserts that find both buckets full search breadth-first
+// for the shortest chain of displacements ending in a free slot.
+template<typename K, typename V>
+class HashTableCuckoo {
+private:
+    static constexpr int slotsPerBucket = 4;    // Slots per bucket
+    static constexpr int stashCapacity = 8;     // Entries that may overflow into the stash
+    static constexpr int maxSearchNodes = 512;  // Buckets the breadth-first search may visit per insert
+
+    struct Entry {
+        K key{};              // The key of the entry
+        V value{};            // The value associated with the key
+        size_t hashValue = 0; // Full (mixed) hash of the key
+    };
+
+    // A node of the breadth-first search: a bucket reached by displacing the entry in slot
+    // `slot` of the parent node's bucket.
+    struct SearchNode {
+        int bucket;
+        int parent;
+        int slot;
+    };
+
+    struct Bucket {
+        array<uint8_t, slotsPerBucket> tags{};   // Per-slot tags; 0 marks a free slot
+        array<Entry, slotsPerBucket> entries;
+    };
+
+    vector<Bucket> buckets;                      // bucketCount buckets
+    vector<Entry> stash;                         // Entries that did not fit anywhere
+    int bucketCount;                             // Number of buckets
+    int size;                                    // Current number of entries
+
+    static size_t hashKey(const K& key) {
+        return static_cast<size_t>(mixHash(hash<K>()(key)));
+    }
+
+    // The tag is the top byte of the hash, never 0.
+    static uint8_t tagOf(size_t hashValue) {
+        uint8_t tag = static_cast<uint8_t>(hashValue >> 56);
+        return tag == 0 ? 1 : tag;
+    }
+
+    int firstBucket(size_t hashValue) const {
+        return static_cast<int>((static_cast<uint64_t>(static_cast<uint32_t>(hashValue)) * bucketCount) >> 32);
+    }
+
+    int secondBucket(size_t hashValue) const {
+        int bucket = static_cast<int>((static_cast<uint64_t>(static_cast<uint32_t>(mixHash(hashValue))) * bucketCount) >> 32);
+        int first = firstBucket(hashValue);
+        return bucket != first || bucketCount == 1 ? bucket : (first + 1) % bucketCount;
+    }
+
+    // The other bucket an entry stored in `bucket` may live in.
+    int alternateBucket(size_t hashValue, int bucket) const {
+        int first = firstBucket(hashValue);
+        return bucket == first ? secondBucket(hashValue) : first;
+    }
+
+    // Returns the slot number (bucket * 4 + way) of a key in one bucket, or -1.
+    int findInBucket(int bucket, size_t hashValue, uint8_t tag, const K& key) const {
+        const Bucket& candidates = buckets[bucket];
+        for (int way = 0; way < slotsPerBucket; ++way) {
+            if (candidates.tags[way] == tag) {
+                const Entry& entry = candidates.entries[way];
+                if (entry.hashValue == hashValue && entry.key == key) {
+                    return bucket * slotsPerBucket + way;
+                }
+            }
+        }
+        return -1;
+    }
+
+    int freeWay(int bucket) const {
+        for (int way = 0; way < slotsPerBucket; ++way) {
+            if (buckets[bucket].tags[way] == 0) {
+                return way;
+            }
+        }
+        return -1;
+    }
+
+    void storeAt(int bucket, int way, Entry&& entry) {
+        buckets[bucket].tags[way] = tagOf(entry.hashValue);
+        buckets[bucket].entries[way] = move(entry);
+    }
+
+    // Breadth-first search for a chain of displacements from one of the key's buckets to a free
+    // slot. Each bucket is visited once, so a chain never passes through the same bucket twice.
+    // On success the chain is carried out from the free end backwards, so every entry stays in one
+    // of its two buckets throughout, and the freed slot (bucket, way) is returned.
+    bool makeRoom(size_t hashValue, int& freedBucket, int& freedWay) {
+        vector<SearchNode> nodes;
+        nodes.push_back(SearchNode{ firstBucket(hashValue), -1, -1 });
+        nodes.push_back(SearchNode{ secondBucket(hashValue), -1, -1 });
+        auto visited = [&nodes](int bucket) {
+            for (const SearchNode& node : nodes) {
+                if (node.bucket == bucket) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        for (size_t current = 0; current < nodes.size(); ++current) {
+            int bucket = nodes[current].bucket;
+            for (int way = 0; way < slotsPerBucket; ++way) {
+                int target = alternateBucket(buckets[bucket].entries[way].hashValue, bucket);
+                if (visited(target)) {
+                    continue;   // Already full and on a shorter chain, or on this one
+                }
+                int free = freeWay(target);
+                if (free >= 0) {
+                    // Walk back up the chain, moving each entry into the slot freed below it.
+                    int toBucket = target, toWay = free;
+                    int fromNode = static_cast<int>(current), fromWay = way;
+                    while (fromNode >= 0) {
+                        int fromBucket = nodes[fromNode].bucket;
+                        storeAt(toBucket, toWay, move(buckets[fromBucket].entries[fromWay]));
+                        buckets[fromBucket].tags[fromWay] = 0;
+                        toBucket = fromBucket;
+                        toWay = fromWay;
+                        fromWay = nodes[fromNode].slot;
+                        fromNode = nodes[fromNode].parent;
+                    }
+                    freedBucket = toBucket;
+                    freedWay = toWay;
+                    return true;
+                }
+                if (static_cast<int>(nodes.size()) < maxSearchNodes) {
+                    nodes.push_back(SearchNode{ target, static_cast<int>(current), way });
+                }
+            }
+        }
+        return false;
+    }
+
+    // Tries to move stashed entries back into their buckets after space was freed.
+    void drainStash() {
+        for (size_t i = 0; i < stash.size();) {
+            size_t hashValue = stash[i].hashValue;
+            int bucket = firstBucket(hashValue);
+            int way = freeWay(bucket);
+            if (way < 0) {
+                bucket = secondBucket(hashValue);
+                way = freeWay(bucket);
+            }
+            if (way < 0) {
+                ++i;
+                continue;
+            }
+            storeAt(bucket, way, move(stash[i]));
+            stash.erase(stash.begin() + i);
+        }
+    }
+
+public:
+    // Constructor to initialize the hash table with room for at least `capacity` entries.
+    HashTableCuckoo(int capacity = 15000)
+        : buckets(max(1, (capacity + slotsPerBucket - 1) / slotsPerBucket)),
+          bucketCount(static_cast<int>(buckets.size())), size(0) {}
+
+    int getSize() const { return size; }
+    int getCapacity() const { return bucketCount * slotsPerBucket; }
+
+    // Returns a pointer to the value for a key, or nullptr when it is not in the table.
+    V* find(const K& key) {
+        return const_cast<V*>(static_cast<const HashTableCuckoo*>(this)->find(key));
+    }
+
+    const V* find(const K& key) const {
+        size_t hashValue = hashKey(key);
+        uint8_t tag = tagOf(hashValue);
+        int slot = findInBucket(firstBucket(hashValue), hashValue, tag, key);
+        if (slot < 0) {
+            slot = findInBucket(secondBucket(hashValue), hashValue, tag, key);
+        }
+        if (slot >= 0) {
+            return &buckets[slot / slotsPerBucket].entries[slot % slotsPerBucket].value;
+        }
+        for (const Entry& entry : stash) {
+            if (entry.hashValue == hashValue && entry.key == key) {
+                return &entry.value;
+            }
+        }
+        return nullptr;
+    }
+
+    bool contains(const K& key) const {
+        return find(key) != nullptr;
+    }
+
+    // Method to insert a key-value pair, overwriting the value of an existing key.
+    void insert(K key, V value) {
+        V* existing = find(key);
+        if (existing != nullptr) {
+            *existing = move(value);
+            return;
+        }
+
+        Entry entry;
+        entry.hashValue = hashKey(key);
+        entry.key = move(key);
+        entry.value = move(value);
+
+        int bucket = firstBucket(entry.hashValue);
+        int way = freeWay(bucket);
+        if (way < 0) {
+            bucket = secondBucket(entry.hashValue);
+            way = freeWay(bucket);
+        }
+        if (way < 0 && !makeRoom(entry.hashValue, bucket, way)) {
+            if (static_cast<int>(stash.size()) == stashCapacity) {
+                throw overflow_error("Hash table is full");
+            }
+            stash.push_back(move(entry));
+            size++;
+            return;
+        }
+        storeAt(bucket, way, move(entry));
+        size++;
+    }
+
+    // Method to retrieve the value associated with a key.
+    V retrieve(const K& key) const {
+        const V* value = find(key);
+        if (value == nullptr) {
+            throw runtime_error("Key not found");
+        }
+        return *value;
+    }
+
+    // Method to remove an entry by key. Cuckoo tables need no tombstones: the slot is simply freed.
+    bool remove(const K& key) {
+        size_t hashValue = hashKey(key);
+        uint8_t tag = tagOf(hashValue);
+        int slot = findInBucket(firstBucket(hashValue), hashValue, tag, key);
+        if (slot < 0) {
+            slot = findInBucket(secondBucket(hashValue), hashValue, tag, key);
+        }
+        if (slot >= 0) {
+            buckets[slot / slotsPerBucket].tags[slot % slotsPerBucket] = 0;
+            buckets[slot / slotsPerBucket].entries[slot % slotsPerBucket] = Entry();
+            size--;
+            if (!stash.empty()) {
+                drainStash();
+            }
+            return true;
+        }
+        for (size_t i = 0; i < stash.size(); ++i) {
+            if (stash[i].hashValue == hashValue && stash[i].key == key) {
+                stash.erase(stash.begin() + i);
+                size--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Calls fn(key, value) for every entry, buckets first and then the stash.
+    template<typename Function>
+    void for_each(Function fn) const {
+        for (int bucket = 0; bucket < bucketCount; ++bucket) {
+            for (int way = 0; way < slotsPerBucket; ++way) {
+                if (buckets[bucket].tags[way] != 0) {
+                    const Entry& entry = buckets[bucket].entries[way];
+                    fn(entry.key, entry.value);
+                }
+            }
+        }
+        for (const Entry& entry : stash) {
+            fn(entry.key, entry.value);
+        }
+    }
+
+    // Removes all entries while keeping the capacity.
+    void clear() {
+        for (auto& bucket : buckets) {
+            bucket = Bucket();
+        }
+        stash.clear();
+        size = 0;
+    }
+};
+
+// A hopscotch hash table with the same API as HashTableLinearProbing. Every key is kept within
+// `neighborhood` slots of its home slot, and each home slot has a bitmap of which of those slots
+// hold its keys, so retrieve only looks at the slots named in one bitmap: one or two cache lines
+// even at 0.9 load, and never a probe through unrelated keys. The bitmap is stored in the home slot
+// itself, so reading it usually brings in the first candidate entry as well. Because a lookup only
+// depends on one bitmap and the slots it names, readers could later be made concurrent with a lock
+// or version counter per group of home slots, without touching the rest of the table.
+template<typename K, typename V>
+class HashTableHopscotch {
+private:
+    static constexpr int neighborhood = 64;  // Maximum distance of a key from its home slot (bits per bitmap)
+
+    struct Entry {
+        K key{};               // The key of the entry
+        V value{};             // The value associated with the key
+        size_t hashValue = 0;  // Full (mixed) hash of the key
+        bool occupied = false; // Flag to indicate if the slot holds an entry
+    };
+
+    struct Slot {
+        uint64_t hopInfo = 0;  // Bit d is set when the slot d places further on holds a key whose home is this slot
+        Entry entry;           // The entry stored in this slot, whatever its home
+    };
+
+    vector<Slot> slots;        // The slots
+    int capacity;              // Number of slots
+    int size;                  // Current number of entries
+
+    static size_t hashKey(const K& key) {
+        return static_cast<size_t>(mixHash(hash<K>()(key)));
+    }
+
+    int homeSlot(size_t hashValue) const {
+        return static_cast<int>((static_cast<uint64_t>(static_cast<uint32_t>(hashValue)) * capacity) >> 32);
+    }
+
+    int slotAt(int home, int distance) const {
+        int index = home + distance;
+        return index >= capacity ? index - capacity : index;
+    }
+
+    int distanceBetween(int from, int to) const {
+        return to >= from ? to - from : to + capacity - from;
+    }
+
+    // Returns the slot holding a key, or -1.
+    int findSlot(size_t hashValue, const K& key) const {
+        int home = homeSlot(hashValue);
+        uint64_t bits = slots[home].hopInfo;
+        while (bits != 0) {
+            int index = slotAt(home, countTrailingZeros(bits));
+            bits &= bits - 1;
+            const Entry& entry = slots[index].entry;
+            if (entry.hashValue == hashValue && entry.key == key) {
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    // Moves some entry closer to its home into the free slot, so that the free slot ends up
+    // closer to `free - neighborhood`. Returns the new free slot, or -1 if nothing can move.
+    int moveFreeSlotCloser(int free) {
+        for (int distance = neighborhood - 1; distance > 0; --distance) {
+            int candidateHome = slotAt(free, capacity - distance);  // free - distance, wrapping
+            uint64_t bits = slots[candidateHome].hopInfo;
+            if (bits != 0) {
+                int offset = countTrailingZeros(bits);
+                if (offset < distance) {  // Only entries sitting before the free slot can move into it.
+                    int from = slotAt(candidateHome, offset);
+                    slots[free].entry = move(slots[from].entry);
+                    slots[from].entry = Entry();
+                    slots[candidateHome].hopInfo = (bits & ~(uint64_t(1) << offset)) | (uint64_t(1) << distance);
+                    return from;
+                }
+            }
+        }
+        return -1;
+    }
+
+public:
+    // Constructor to initialize the hash table with a specified capacity.
+    HashTableHopscotch(int capacity = 15000) : slots(max(1, capacity)), capacity(max(1, capacity)), size(0) {}
+
+    int getSize() const { return size; }
+    int getCapacity() const { return capacity; }
+
+    // Returns a pointer to the value for a key, or nullptr when it is not in the table.
+    V* find(const K& key) {
+        int index = findSlot(hashKey(key), key);
+        return index < 0 ? nullptr : &slots[index].entry.value;
+    }
+
+    const V* find(const K& key) const {
+        int index = findSlot(hashKey(key), key);
+        return index < 0 ? nullptr : &slots[index].entry.value;
+    }
+
+    bool contains(const K& key) const {
+        return find(key) != nullptr;
+    }
+
+    // Method to insert a key-value pair, overwriting the value of an existing key.
+    // Throws overflow_error when there is no free slot, or no way to bring one into the neighborhood.
+    void insert(K key, V value) {
+        size_t hashValue = hashKey(key);
+        int existing = findSlot(hashValue, key);
+        if (existing >= 0) {
+            slots[existing].entry.value = move(value);
+            return;
+        }
+
+        // Find the nearest free slot by linear probing from the home slot.
+        int home = homeSlot(hashValue);
+        int free = home;
+        int distance = 0;
+        while (slots[free].entry.occupied) {
+            if (++distance == capacity) {
+                throw overflow_error("Hash table is full");
+            }
+            free = slotAt(free, 1);
+        }
+
+        // Hop the free slot backwards until it is inside the home slot's neighborhood.
+        while (distance >= neighborhood) {
+            free = moveFreeSlotCloser(free);
+            if (free < 0) {
+                throw overflow_error("Hash table is full");
+            }
+            distance = distanceBetween(home, free);
+        }
+
+        Entry& entry = slots[free].entry;
+        entry.key = move(key);
+        entry.value = move(value);
+        entry.hashValue = hashValue;
+        entry.occupied = true;
+        slots[home].hopInfo |= uint64_t(1) << distance;
+        size++;
+    }
+
+    // Method to retrieve the value associated with a key.
+    V retrieve(const K& key) const {
+        const V* value = find(key);
+        if (value == nullptr) {
+            throw runtime_error("Key not found");
+        }
+        return *value;
+    }
+
+    // Method to remove an entry by key. The slot is freed outright; no tombstone is needed.
+    bool remove(const K& key) {
+        size_t hashValue = hashKey(key);
+        int index = findSlot(hashValue, key);
+        if (index < 0) {
+            return false;
+        }
+        int home = homeSlot(hashValue);
+        slots[home].hopInfo &= ~(uint64_t(1) << distanceBetween(home, index));
+        slots[index].entry = Entry();
+        size--;
+        return true;
+    }
+
+    // Calls fn(key, value) for every entry in slot order.
+    template<typename Function>
+    void for_each(Function fn) const {
+        for (const Slot& slot : slots) {
+            if (slot.entry.occupied) {
+                fn(slot.entry.key, slot.entry.value);
+            }
+        }
+    }
+
+    // Removes all entries while keeping the capacity.
+    void clear() {
+        for (auto& slot : slots) {
+            slot = Slot();
+        }
+        size = 0;
+    }
+};
+
+// Returns a mask with the high bit set in every byte of `tags` equal to `tag` (eight one-byte tags
+// compared at once). A borrow can also flag the byte after a real match, so callers check the keys.
+inline uint64_t matchTagBytes(uint64_t tags, uint8_t tag) {
+    const uint64_t lowBits = 0x0101010101010101ULL;
+    const uint64_t highBits = 0x8080808080808080ULL;
+    uint64_t x = tags ^ (lowBits * tag);
+    return (x - lowBits) & ~x & highBits;
+}
+
+// A two-level table in the style of iceberg hashing, for running close to full. Most keys live in
+// the front yard: one bucket of 64 slots per key, chosen by the hash. Keys whose front bucket is
+// full go to a backyard about a tenth of the size, where each key may use the emptier of two
+// 16-slot buckets; this keeps inserts succeeding past a load of 0.95. Every slot has a one-byte
+// tag, and a bucket's tags are compared eight at a time, so a lookup checks one front bucket and
+// at most two backyard buckets however full the table is.
+// Entries never move once inserted, so pointers returned by find() stay valid until that key is
+// removed. Same API as HashTableLinearProbing.
+template<typename K, typename V>
+class HashTableIceberg {
+private:
+    static constexpr int frontSlots = 64;       // Slots per front-yard bucket (one cache line of tags)
+    static constexpr int backSlots = 16;        // Slots per backyard bucket
+    static constexpr double frontShare = 0.9;   // Share of the capacity given to the front yard
+
+    struct Entry {
+        K key{};    // The key of the entry
+        V value{};  // The value associated with the key
+    };
+
+    vector<uint64_t> frontTags;  // frontSlots / 8 tag words per front bucket; tag 0 marks a free slot
+    vector<Entry> frontEntries;
+    vector<uint64_t> backTags;   // backSlots / 8 tag words per backyard bucket
+    vector<Entry> backEntries;
+    int frontBuckets;
+    int backBuckets;
+    int size;                    // Current number of entries
+    int backyardSize;            // Entries living in the backyard
+
+    static uint64_t hashKey(const K& key) {
+        return mixHash(hash<K>()(key));
+    }
+
+    static uint8_t tagOf(uint64_t hashValue) {
+        uint8_t tag = static_cast<uint8_t>(hashValue >> 56);
+        return tag == 0 ? 1 : tag;
+    }
+
+    static int reduce(uint64_t bits, int range) {
+        return static_cast<int>((static_cast<uint64_t>(static_cast<uint32_t>(bits)) * range) >> 32);
+    }
+
+    int frontBucket(uint64_t hashValue) const { return reduce(hashValue, frontBuckets); }
+    int backBucket(uint64_t hashValue, int choice) const { return reduce(mixHash(hashValue + choice + 1), backBuckets); }
+
+    static uint8_t tagByte(uint64_t word, int byte) { return static_cast<uint8_t>(word >> (byte * 8)); }
+
+    static void setTag(uint64_t& word, int byte, uint8_t tag) {
+        word = (word & ~(uint64_t(0xFF) << (byte * 8))) | (static_cast<uint64_t>(tag) << (byte * 8));
+    }
+
+    // Finds the key among a run of tag words and their entries; returns the slot number or -1.
+    static int findIn(const uint64_t* tags, int words, const Entry* entries, uint8_t tag, const K& key) {
+        for (int word = 0; word < words; ++word) {
+            uint64_t matches = matchTagBytes(tags[word], tag);
+            while (matches != 0) {
+                int slot = word * 8 + countTrailingZeros(matches) / 8;
+                matches &= matches - 1;
+                if (tagByte(tags[word], slot % 8) == tag && entries[slot].key == key) {
+                    return slot;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Returns the first free slot among a run of tag words, or -1.
+    static int freeIn(const uint64_t* tags, int words) {
+        for (int word = 0; word < words; ++word) {
+            uint64_t matches = matchTagBytes(tags[word], 0);
+            while (matches != 0) {
+                int byte = countTrailingZeros(matches) / 8;
+                matches &= matches - 1;
+                if (tagByte(tags[word], byte) == 0) {
+                    return word * 8 + byte;
+                }
+            }
+        }
+        return -1;
+    }
+
+    static int countUsed(const uint64_t* tags, int words) {
+        int used = 0;
+        for (int byte = 0; byte < words * 8; ++byte) {
+            used += tagByte(tags[byte / 8], byte % 8) != 0;
+        }
+        return used;
+    }
+
+    static constexpr int frontWords = frontSlots / 8;
+    static constexpr int backWords = backSlots / 8;
+
+    // Locates a key: returns its Entry, or nullptr, and reports where it lives.
+    const Entry* locate(const K& key, uint64_t hashValue, bool& inBackyard, int& bucket, int& slot) const {
+        uint8_t tag = tagOf(hashValue);
+        bucket = frontBucket(hashValue);
+        slot = findIn(&frontTags[bucket * frontWords], frontWords, &frontEntries[bucket * frontSlots], tag, key);
+        if (slot >= 0) {
+            inBackyard = false;
+            return &frontEntries[bucket * frontSlots + slot];
+        }
+        if (backyardSize == 0) {
+            return nullptr;
+        }
+        inBackyard = true;
+        for (int choice = 0; choice < 2; ++choice) {
+            bucket = backBucket(hashValue, choice);
+            slot = findIn(&backTags[bucket * backWords], backWords, &backEntries[bucket * backSlots], tag, key);
+            if (slot >= 0) {
+                return &backEntries[bucket * backSlots + slot];
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    // Constructor to initialize the hash table with about `capacity` slots in total.
+    HashTableIceberg(int capacity = 15000)
+        : frontBuckets(max(1, static_cast<int>(capacity * frontShare) / frontSlots)),
+          backBuckets(max(2, static_cast<int>(capacity * (1 - frontShare)) / backSlots)),
+          size(0), backyardSize(0) {
+        frontTags.assign(static_cast<size_t>(frontBuckets) * frontWords, 0);
+        frontEntries.resize(static_cast<size_t>(frontBuckets) * frontSlots);
+        backTags.assign(static_cast<size_t>(backBuckets) * backWords, 0);
+        backEntries.resize(static_cast<size_t>(backBuckets) * backSlots);
+    }
+
+    int getSize() const { return size; }
+    int getCapacity() const { return frontBuckets * frontSlots + backBuckets * backSlots; }
+
+    // Returns a pointer to the value for a key, or nullptr. The pointer stays valid until the key is removed.
+    V* find(const K& key) {
+        return const_cast<V*>(static_cast<const HashTableIceberg*>(this)->find(key));
+    }
+
+    const V* find(const K& key) const {
+        bool inBackyard;
+        int bucket, slot;
+        const Entry* entry = locate(key, hashKey(key), inBackyard, bucket, slot);
+        return entry == nullptr ? nullptr : &entry->value;
+    }
+
+    bool contains(const K& key) const {
+        return find(key) != nullptr;
+    }
+
+    // Method to insert a key-value pair, overwriting the value of an existing key.
+    // Throws overflow_error when the key's front bucket and both backyard buckets are full.
+    void insert(K key, V value) {
+        uint64_t hashValue = hashKey(key);
+        V* existing = find(key);
+        if (existing != nullptr) {
+            *existing = move(value);
+            return;
+        }
+
+        uint8_t tag = tagOf(hashValue);
+        int bucket = frontBucket(hashValue);
+        int slot = freeIn(&frontTags[bucket * frontWords], frontWords);
+        if (slot >= 0) {
+            frontEntries[bucket * frontSlots + slot] = Entry{ move(key), move(value) };
+            setTag(frontTags[bucket * frontWords + slot / 8], slot % 8, tag);
+            size++;
+            return;
+        }
+
+        // The front bucket is full: take the emptier of the two backyard buckets.
+        int first = backBucket(hashValue, 0), second = backBucket(hashValue, 1);
+        bucket = countUsed(&backTags[second * backWords], backWords) < countUsed(&backTags[first * backWords], backWords) ? second : first;
+        slot = freeIn(&backTags[bucket * backWords], backWords);
+        if (slot < 0) {
+            throw overflow_error("Hash table is full");
+        }
+        backEntries[bucket * backSlots + slot] = Entry{ move(key), move(value) };
+        setTag(backTags[bucket * backWords + slot / 8], slot % 8, tag);
+        size++;
+        backyardSize++;
+    }
+
+    // Method to retrieve the value associated with a key.
+    V retrieve(const K& key) const {
+        const V* value = find(key);
+        if (value == nullptr) {
+            throw runtime_error("Key not found");
+        }
+        return *value;
+    }
+
+    // Method to remove an entry by key. Clearing the tag frees the slot; nothing else moves.
+    bool remove(const K& key) {
+        bool inBackyard;
+        int bucket, slot;
+        const Entry* entry = locate(key, hashKey(key), inBackyard, bucket, slot);
+        if (entry == nullptr) {
+            return false;
+        }
+        if (inBackyard) {
+            backEntries[bucket * backSlots + slot] = Entry();
+            setTag(backTags[bucket * backWords + slot / 8], slot % 8, 0);
+            backyardSize--;
+        }
+        else {
+            frontEntries[bucket * frontSlots + slot] = Entry();
+            setTag(frontTags[bucket * frontWords + slot / 8], slot % 8, 0);
+        }
+        size--;
+        return true;
+    }
+
+    // Calls fn(key, value) for every entry, front yard first.
+    template<typename Function>
+    void for_each(Function fn) const {
+        for (size_t slot = 0; slot < frontEntries.size(); ++slot) {
+            if (tagByte(frontTags[slot / 8], slot % 8) != 0) {
+                fn(frontEntries[slot].key, frontEntries[slot].value);
+            }
+        }
+        for (size_t slot = 0; slot < backEntries.size(); ++slot) {
+            if (tagByte(backTags[slot / 8], slot % 8) != 0) {
+                fn(backEntries[slot].key, backEntries[slot].value);
+            }
+        }
+    }
+
+    // Removes all entries while keeping the capacity.
+    void clear() {
+        fill(frontTags.begin(), frontTags.end(), 0);
+        fill(backTags.begin(), backTags.end(), 0);
+        for (auto& entry : frontEntries) {
+            entry = Entry();
+        }
+        for (auto& entry : backEntries) {
+            entry = Entry();
+        }
+        size = 0;
+        backyardSize = 0;
+    }
+};
+
+// Fills a table to the given load factor and reports its insert time, its average lookup time and
+// the distribution of single lookup latencies (median, 99th and 99.9th percentile, worst) in nanoseconds.
+// Shared by the comparative benchmark of the table variants.
+template<typename Table>
+void reportLookupLatency(const string& name, int capacity, double load, const vector<int>& keys) {
+    Table table(capacity);
+    int count = min(static_cast<int>(keys.size()), static_cast<int>(capacity * load));
+    auto insert_start = high_resolution_clock::now();
+    try {
+        for (int i = 0; i < count; ++i) {
+            table.insert(keys[i], i);
+        }
+    }
+    catch (const overflow_error&) {
+        cout << "  " << name << ": full before reaching load " << load << endl;
+        return;
+    }
+    auto insert_end = high_resolution_clock::now();
+
+    // The average comes from a plain loop; timing every lookup separately adds the clock's own
+    // overhead, so those samples are only used for the tail percentiles.
+    long long checksum = 0;
+    auto lookup_start = high_resolution_clock::now();
+    for (int i = 0; i < count; ++i) {
+        checksum += *table.find(keys[i]);
+    }
+    auto lookup_end = high_resolution_clock::now();
+
+    vector<double> latencies(count);
+    for (int i = 0; i < count; ++i) {
+        auto single_start = steady_clock::now();
+        checksum -= *table.find(keys[i]);
+        auto single_end = steady_clock::now();
+        latencies[i] = duration<double, nano>(single_end - single_start).count();
+    }
+    if (count == 0) {
+        return;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    cout << "  " << name << ": insert " << duration<double, nano>(insert_end - insert_start).count() / count
+         << " ns, lookup avg " << duration<double, nano>(lookup_end - lookup_start).count() / count
+         << " ns, timed p50 " << latencies[count / 2] << " ns, p99 " << latencies[count * 99 / 100] << " ns, p99.9 "
+         << latencies[static_cast<size_t>(count * 0.999)] << " ns, worst " << latencies.back()
+         << " ns (checksum " << checksum << ")" << endl;
+}
+
+// Method to compare lookup latency of the table variants at several load factors.
+inline void performVariantTest(int capacity) {
+    mt19937 eng(random_device{}());
+    vector<int> keys;
+    HashTableLinearProbing<int, char> seen(capacity * 2);  // Keeps the keys distinct.
+    while (static_cast<int>(keys.size()) < capacity) {
+        int key = static_cast<int>(eng() & 0x7FFFFFFF);
+        if (!seen.contains(key)) {
+            seen.insert(key, 1);
+            keys.push_back(key);
+        }
+    }
+
+    const double loadFactors[] = { 0.5, 0.8, 0.9, 0.95, 0.97 };
+    for (double load : loadFactors) {
+        cout << "Load " << load << " with " << capacity << " slots:" << endl;
+        reportLookupLatency<HashTableLinearProbing<int, int>>("Linear Probing", capacity, load, keys);
+        reportLookupLatency<HashTableCuckoo<int, int>>("Cuckoo", capacity, load, keys);
+        reportLookupLatency<HashTableHopscotch<int, int>>("Hopscotch", capacity, load, keys);
+        reportLookupLatency<HashTableIceberg<int, int>>("Iceberg", capacity, load, keys);
+    }
+}
+
+// Hash functions that can run at compile time, for ConstexprHashTable.
+// std::hash is not constexpr, so string keys use FNV-1a and integer keys use the splitmix64 finalizer.
+template<typename K, typename Enable = void>
+struct ConstexprHash;
+
+template<>
+struct ConstexprHash<string_view> {
+    constexpr uint64_t operator()(string_view key) const {
+        uint64_t hashValue = 14695981039346656037ULL;
+        for (char c : key) {
+            hashValue = (hashValue ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+        return hashValue;
+    }
+};
+
+template<typename K>
+struct ConstexprHash<K, typename enable_if<is_integral<K>::value>::type> {
+    constexpr uint64_t operator()(K key) const {
+        return mixHash(static_cast<uint64_t>(key) + 0x9E3779B97F4A7C15ULL);
+    }
+};
+
+// A fixed-capacity linear probing table that can be filled at compile time and kept in
+// static constexpr data, for lookup tables whose keys are known when the program is built
+// (command names, protocol fields). Capacity must be a power of two so probing can use a mask.
+// Keys are string_view or integers; values must be literal types.
+template<typename K, typename V, size_t N>
+class ConstexprHashTable {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ConstexprHashTable capacity must be a power of two");
+
+private:
+    struct Slot {
+        K key{};               // The key of the slot
+        V value{};             // The value associated with the key
+        bool occupied = false; // Flag to indicate if the slot holds an entry
+    };
+
+    array<Slot, N> slots{};    // The slots, stored inline
+    size_t size = 0;           // Current number of entries
+
+    // Returns the slot holding key, or the empty slot where it would go, or N if the table is full.
+    constexpr size_t findSlot(const K& key) const {
+        size_t index = ConstexprHash<K>()(key) & (N - 1);
+        for (size_t probes = 0; probes < N; ++probes) {
+            if (!slots[index].occupied || slots[index].key == key) {
+                return index;
+            }
+            index = (index + 1) & (N - 1);
+        }
+        return N;
+    }
+
+public:
+    constexpr ConstexprHashTable() = default;
+
+    // Inserts a key-value pair, overwriting the value of an existing key.
+    constexpr void insert(K key, V value) {
+        size_t index = findSlot(key);
+        if (index == N) {
+            throw overflow_error("Hash table is full");
+        }
+        if (!slots[index].occupied) {
+            slots[index].occupied = true;
+            slots[index].key = key;
+            size++;
+        }
+        slots[index].value = value;
+    }
+
+    // Returns a pointer to the value for a key, or nullptr when the key is not present.
+    constexpr const V* find(K key) const {
+        size_t index = findSlot(key);
+        return index != N && slots[index].occupied ? &slots[index].value : nullptr;
+    }
+
+    constexpr bool contains(K key) const {
+        return find(key) != nullptr;
+    }
+
+    // Retrieves the value for a key, throwing like HashTableLinearProbing::retrieve when it is missing.
+    constexpr V retrieve(K key) const {
+        const V* value = find(key);
+        if (value == nullptr) {
+            throw runtime_error("Key not found");
+        }
+        return *value;
+    }
+
+    constexpr size_t getSize() const { return size; }
+    static constexpr size_t getCapacity() { return N; }
+};
+
+// Capacity used by makeConstexprHashTable: the smallest power of two that keeps the load at or below 0.5.
+constexpr size_t constexprTableCapacity(size_t entries) {
+    size_t capacity = 1;
+    while (capacity < entries * 2) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// Builds a ConstexprHashTable from a braced list of pairs, e.g.
+//     static constexpr auto codes = makeConstexprHashTable<string_view, int>({ {"get", 1}, {"set", 2} });
+// Evaluated at compile time, so the table costs nothing at startup.
+template<typename K, typename V, size_t M>
+constexpr ConstexprHashTable<K, V, constexprTableCapacity(M)> makeConstexprHashTable(const pair<K, V> (&entries)[M]) {
+    ConstexprHashTable<K, V, constexprTableCapacity(M)> table;
+    for (size_t i = 0; i < M; ++i) {
+        table.insert(entries[i].first, entries[i].second);
+    }
+    return table;
+}
+
+// Executes line-oriented commands against a table of string keys and int values:
+//     PUT key value   -> OK            (SET is accepted as a synonym)
+//     GET key         -> value | NIL
+//     DEL key         -> OK | NIL
+//     MGET key...     -> one value or NIL per key, on one line
+//     STATS           -> STATS commands=N keys=N syscalls=N syscalls_per_op=X
+//     DUMP [n i]      -> one "key value" line per entry, then END; with n and i only the keys
+//                        jumpConsistentHash places in bucket i of n
+// Errors answer "ERROR <message>". Input is parsed in place from a byte buffer and replies are
+// appended to a string, so the same processor serves batch files, pipes and socket connections.
+// Runs of GETs in a buffer are looked up together through findBatch.
+class CommandProcessor {
+public:
+    enum CommandCode : uint8_t { PutCommand, GetCommand, DelCommand, MultiGetCommand, StatsCommand, DumpCommand };
+
+private:
+    static constexpr auto commandCodes = makeConstexprHashTable<string_view, CommandCode>({
+        { "PUT", PutCommand }, { "SET", PutCommand }, { "GET", GetCommand },
+        { "DEL", DelCommand }, { "MGET", MultiGetCommand }, { "STATS", StatsCommand }, { "DUMP", DumpCommand } });
+    static constexpr size_t getBatchSize = 64;  // Most GETs looked up by one findBatch call
+
+    HashTableLinearProbing<string, int>& table;
+    string scratchKey;          // Reused for lookups so parsing does not allocate per command
+    uint64_t operations = 0;    // Commands executed, including failed ones
+    const uint64_t* syscalls = nullptr;     // Counter of the server feeding this processor, if any
+    vector<string> pendingKeys;             // Keys of the GETs queued for the next findBatch
+    vector<const int*> pendingResults;
+    size_t pendingCount = 0;
+    bool readOnly = false;                  // Refuse PUT and DEL, e.g. on a replica
+
+    // Splits the next whitespace-separated token off the front of rest.
+    static string_view nextToken(string_view& rest) {
+        size_t start = rest.find_first_not_of(" \t");
+        if (start == string_view::npos) {
+            rest = string_view();
+            return string_view();
+        }
+        size_t stop = rest.find_first_of(" \t", start);
+        string_view token = rest.substr(start, stop == string_view::npos ? string_view::npos : stop - start);
+        rest = stop == string_view::npos ? string_view() : rest.substr(stop);
+        return token;
+    }
+
+    static bool parseValue(string_view token, int& value) {
+        auto result = from_chars(token.data(), token.data() + token.size(), value);
+        return result.ec == errc() && result.ptr == token.data() + token.size();
+    }
+
+    static void appendValue(string& out, int value) {
+        char digits[16];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr);
+    }
+
+    const int* lookup(string_view key) {
+        scratchKey.assign(key.data(), key.size());
+        return table.find(scratchKey);
+    }
+
+    // Queues a line if it is a well-formed GET; anything else is left to processLine.
+    bool queueGet(string_view line, string& out) {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        string_view rest = line;
+        const CommandCode* code = commandCodes.find(nextToken(rest));
+        string_view key = nextToken(rest);
+        if (code == nullptr || *code != GetCommand || key.empty() || !nextToken(rest).empty()) {
+            return false;
+        }
+        pendingKeys[pendingCount++].assign(key.data(), key.size());
+        operations++;
+        if (pendingCount == getBatchSize) {
+            flushGets(out);
+        }
+        return true;
+    }
+
+    // Looks up the queued GETs in one batch and appends their replies in order.
+    void flushGets(string& out) {
+        if (pendingCount == 0) {
+            return;
+        }
+        table.findBatch(pendingKeys.data(), pendingCount, pendingResults.data());
+        for (size_t i = 0; i < pendingCount; ++i) {
+            if (pendingResults[i] == nullptr) {
+                out += "NIL\n";
+            }
+            else {
+                appendValue(out, *pendingResults[i]);
+                out += '\n';
+            }
+        }
+        pendingCount = 0;
+    }
+
+public:
+    explicit CommandProcessor(HashTableLinearProbing<string, int>& table)
+        : table(table), pendingKeys(getBatchSize), pendingResults(getBatchSize) {}
+
+    uint64_t getOperationCount() const { return operations; }
+
+    // Lets STATS report the system calls made by the server that owns counter.
+    void attachSyscallCounter(const uint64_t* counter) { syscalls = counter; }
+
+    void setReadOnly(bool enabled) { readOnly = enabled; }
+
+    // Executes one command line (without its newline) and appends the reply line to out.
+    void processLine(string_view line, string& out) {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        string_view rest = line;
+        string_view name = nextToken(rest);
+        if (name.empty()) {
+            return;
+        }
+        operations++;
+        const CommandCode* code = commandCodes.find(name);
+        if (code == nullptr) {
+            out += "ERROR Unknown command\n";
+            return;
+        }
+
+        if (readOnly && (*code == PutCommand || *code == DelCommand)) {
+            out += "ERROR Read-only replica\n";
+            return;
+        }
+
+        switch (*code) {
+        case PutCommand: {
+            string_view key = nextToken(rest);
+            int value;
+            if (key.empty() || !parseValue(nextToken(rest), value) || !nextToken(rest).empty()) {
+                out += "ERROR Invalid arguments\n";
+                return;
+            }
+            try {
+                table.insert(string(key), value);
+                out += "OK\n";
+            }
+            catch (const overflow_error& e) {
+                out += "ERROR ";
+                out += e.what();
+                out += '\n';
+            }
+            break;
+        }
+        case GetCommand: {
+            string_view key = nextToken(rest);
+            if (key.empty() || !nextToken(rest).empty()) {
+                out += "ERROR Invalid arguments\n";
+                return;
+            }
+            const int* value = lookup(key);
+            if (value == nullptr) {
+                out += "NIL\n";
+            }
+            else {
+                appendValue(out, *value);
+                out += '\n';
+            }
+            break;
+        }
+        case DelCommand: {
+            string_view key = nextToken(rest);
+            if (key.empty() || !nextToken(rest).empty()) {
+                out += "ERROR Invalid arguments\n";
+                return;
+            }
+            scratchKey.assign(key.data(), key.size());
+            out += table.remove(scratchKey) ? "OK\n" : "NIL\n";
+            break;
+        }
+        case MultiGetCommand: {
+            string_view key = nextToken(rest);
+            if (key.empty()) {
+                out += "ERROR Invalid arguments\n";
+                return;
+            }
+            for (bool first = true; !key.empty(); key = nextToken(rest), first = false) {
+                if (!first) {
+                    out += ' ';
+                }
+                const int* value = lookup(key);
+                if (value == nullptr) {
+                    out += "NIL";
+                }
+                else {
+                    appendValue(out, *value);
+                }
+            }
+            out += '\n';
+            break;
+        }
+        case StatsCommand: {
+            uint64_t calls = syscalls == nullptr ? 0 : *syscalls;
+            out += "STATS commands=" + to_string(operations) + " keys=" + to_string(table.getSize())
+                + " syscalls=" + to_string(calls) + " syscalls_per_op=" + to_string(static_cast<double>(calls) / operations) + "\n";
+            break;
+        }
+        case DumpCommand: {
+            int buckets = 0, bucket = 0;
+            string_view first = nextToken(rest);
+            if (!first.empty() && (!parseValue(first, buckets) || !parseValue(nextToken(rest), bucket) || buckets <= 0)) {
+                out += "ERROR Invalid arguments\n";
+                return;
+            }
+            table.for_each([&](const string& key, const int& value) {
+                if (buckets == 0 || jumpConsistentHash(hash<string>()(key), buckets) == bucket) {
+                    out += key;
+                    out += ' ';
+                    appendValue(out, value);
+                    out += '\n';
+                }
+            });
+            out += "END\n";
+            break;
+        }
+        }
+    }
+
+    // Executes every complete line in data and returns the number of bytes consumed; a trailing
+    // partial line is left for the caller to complete with more input.
+    size_t processBuffer(const char* data, size_t length, string& out) {
+        size_t consumed = 0;
+        while (consumed < length) {
+            const char* newline = static_cast<const char*>(memchr(data + consumed, '\n', length - consumed));
+            if (newline == nullptr) {
+                break;
+            }
+            string_view line(data + consumed, newline - (data + consumed));
+            if (!queueGet(line, out)) {
+                flushGets(out);
+                processLine(line, out);
+            }
+            consumed = newline - data + 1;
+        }
+        flushGets(out);
+        return consumed;
+    }
+
+    // Executes a whole command stream, reading and writing in large blocks. When record is not
+    // null the executed input is copied to it, producing a trace that --replay can run again.
+    void run(istream& in, ostream& out, ostream* record = nullptr) {
+        const size_t flushThreshold = 1 << 16;
+        vector<char> buffer(1 << 16);
+        size_t filled = 0;
+        string replies;
+        while (true) {
+            in.read(buffer.data() + filled, buffer.size() - filled);
+            size_t received = static_cast<size_t>(in.gcount());
+            filled += received;
+            size_t consumed = processBuffer(buffer.data(), filled, replies);
+            bool finished = received == 0;
+            if (finished && consumed < filled) {
+                processLine(string_view(buffer.data() + consumed, filled - consumed), replies);
+                consumed = filled;
+            }
+            if (record != nullptr) {
+                record->write(buffer.data(), consumed);
+            }
+            if (replies.size() >= flushThreshold || finished) {
+                out.write(replies.data(), replies.size());
+                replies.clear();
+            }
+            if (finished) {
+                break;
+            }
+            // Keep the partial line, growing the buffer if a single line fills it.
+            memmove(buffer.data(), buffer.data() + consumed, filled - consumed);
+            filled -= consumed;
+            if (filled == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
+            }
+        }
+        out.flush();
+    }
+};
+
+// A value in the memcached-compatible cache.
+struct CacheItem {
+    string data;                // The stored bytes
+    uint32_t flags = 0;         // Opaque client flags, returned with the data
+    uint64_t cas = 0;           // Version number, changed by every store
+    int64_t expiresAt = 0;      // Unix time the item expires at; 0 never expires
+    bool referenced = false;    // Set by reads; the CLOCK sweep spares a referenced item once
+};
+
+// Speaks memcached's text protocol (get, gets, set, delete, incr, decr, stats, version) over a
+// HashTableLinearProbing of CacheItems. It has CommandProcessor's processBuffer interface, so it
+// runs behind either server backend. Once the items reach the item or memory limit, CLOCK evicts
+// down to 7/8 of the limits: reads set an item's referenced bit, and a hand that keeps its place
+// between evictions walks the slots, clearing the bit of referenced items and evicting the rest
+// (expired items always go) until the new item fits. Items larger than 7/8 of the memory limit
+// are refused outright.
+class MemcachedProcessor {
+private:
+    enum CommandCode : uint8_t { GetCommand, GetsCommand, SetCommand, DeleteCommand, IncrCommand, DecrCommand, StatsCommand, VersionCommand };
+
+    static constexpr auto commandCodes = makeConstexprHashTable<string_view, CommandCode>({
+        { "get", GetCommand }, { "gets", GetsCommand }, { "set", SetCommand }, { "delete", DeleteCommand },
+        { "incr", IncrCommand }, { "decr", DecrCommand }, { "stats", StatsCommand }, { "version", VersionCommand } });
+    static constexpr size_t maxKeyLength = 250;
+    static constexpr size_t maxSkippedBlock = 1 << 21;  // Refused data blocks up to this size are read and dropped
+    static constexpr size_t itemOverhead = 64;       // Bytes charged per item besides key and data
+    static constexpr int64_t relativeExpiryLimit = 60 * 60 * 24 * 30;  // Larger exptimes are Unix times
+
+    HashTableLinearProbing<string, CacheItem>& table;
+    size_t maxItems;            // Evict once this many items are stored
+    size_t memoryLimit;         // Evict once keys, data and overhead take this many bytes
+    size_t memoryUsed = 0;
+    int clockHand = 0;          // Slot the CLOCK hand stopped at; the next eviction carries on from there
+    uint64_t nextCas = 1;
+    string scratchKey;          // Reused for lookups so parsing does not allocate per command
+    const uint64_t* syscalls = nullptr;
+    uint64_t operations = 0, getHits = 0, getMisses = 0, sets = 0, evictions = 0;
+
+    static size_t itemBytes(const string& key, const CacheItem& item) {
+        return key.size() + item.data.size() + itemOverhead;
+    }
+
+    static bool expired(const CacheItem& item, int64_t now) {
+        return item.expiresAt != 0 && item.expiresAt <= now;
+    }
+
+    static string_view nextToken(string_view& rest) {
+        size_t start = rest.find_first_not_of(' ');
+        if (start == string_view::npos) {
+            rest = string_view();
+            return string_view();
+        }
+        size_t stop = rest.find(' ', start);
+        string_view token = rest.substr(start, stop == string_view::npos ? string_view::npos : stop - start);
+        rest = stop == string_view::npos ? string_view() : rest.substr(stop);
+        return token;
+    }
+
+    template<typename T>
+    static bool parseNumber(string_view token, T& value) {
+        auto result = from_chars(token.data(), token.data() + token.size(), value);
+        return !token.empty() && result.ec == errc() && result.ptr == token.data() + token.size();
+    }
+
+    // Returns the live item for a key, dropping it if it has expired.
+    CacheItem* lookup(string_view key, int64_t now) {
+        scratchKey.assign(key.data(), key.size());
+        CacheItem* item = table.find(scratchKey);
+        if (item != nullptr && expired(*item, now)) {
+            memoryUsed -= itemBytes(scratchKey, *item);
+            table.remove(scratchKey);
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Eviction brings memory down to this. It is also the most one item may take: a larger one
+    // would empty the cache and still not fit, so it is refused instead.
+    size_t memoryTarget() const { return memoryLimit - memoryLimit / 8; }
+
+    // Advances the CLOCK hand until a new item of the given size fits under both limits with room
+    // to spare. The hand stops as soon as it does, so items it has not reached keep their bits.
+    void makeRoom(size_t incomingBytes) {
+        if (static_cast<size_t>(table.getSize()) < maxItems && memoryUsed + incomingBytes <= memoryLimit) {
+            return;
+        }
+        size_t itemTarget = maxItems - maxItems / 8;
+        int64_t now = time(nullptr);
+        while (table.getSize() > 0 && (static_cast<size_t>(table.getSize()) > itemTarget || memoryUsed + incomingBytes > memoryTarget())) {
+            auto hand = table.iteratorAt(clockHand);
+            if (hand == table.end()) {
+                clockHand = 0;
+                continue;
+            }
+            clockHand = hand.slot() + 1;
+            auto entry = *hand;
+            if (!expired(entry.second, now) && entry.second.referenced) {
+                entry.second.referenced = false;   // Second chance: spared until the hand comes round again.
+                continue;
+            }
+            memoryUsed -= itemBytes(entry.first, entry.second);
+            table.remove(entry.first);
+            evictions++;
+        }
+    }
+
+    void appendValue(string& out, string_view key, const CacheItem& item, bool withCas) {
+        out += "VALUE ";
+        out.append(key.data(), key.size());
+        out += ' ';
+        out += to_string(item.flags);
+        out += ' ';
+        out += to_string(item.data.size());
+        if (withCas) {
+            out += ' ';
+            out += to_string(item.cas);
+        }
+        out += "\r\n";
+        out += item.data;
+        out += "\r\n";
+    }
+
+    void get(string_view rest, bool withCas, string& out) {
+        int64_t now = time(nullptr);
+        for (string_view key = nextToken(rest); !key.empty(); key = nextToken(rest)) {
+            CacheItem* item = lookup(key, now);
+            if (item == nullptr) {
+                getMisses++;
+                continue;
+            }
+            getHits++;
+            item->referenced = true;
+            appendValue(out, key, *item, withCas);
+        }
+        out += "END\r\n";
+    }
+
+    // Stores a set command's data block; the header has already been validated.
+    void set(string_view key, uint32_t flags, int64_t exptime, string_view block, bool noreply, string& out) {
+        sets++;
+        int64_t now = time(nullptr);
+        CacheItem item;
+        item.data.assign(block.data(), block.size());
+        item.flags = flags;
+        item.cas = nextCas++;
+        item.expiresAt = exptime == 0 ? 0 : exptime > relativeExpiryLimit ? exptime : now + exptime;
+        scratchKey.assign(key.data(), key.size());
+        if (CacheItem* existing = table.find(scratchKey)) {
+            memoryUsed -= itemBytes(scratchKey, *existing);
+            table.remove(scratchKey);
+        }
+        if (exptime < 0) {
+            // A negative exptime stores an already expired item, which is the same as deleting it.
+            if (!noreply) {
+                out += "STORED\r\n";
+            }
+            return;
+        }
+        size_t bytes = itemBytes(scratchKey, item);
+        if (bytes > memoryTarget()) {
+            // Evicting everything would not make room for it either.
+            out += "SERVER_ERROR object too large for cache\r\n";
+            return;
+        }
+        makeRoom(bytes);
+        if (table.getSize() + table.getTombstoneCount() >= table.getCapacity()) {
+            // Tombstones took the last free slots between purges; sweep them out.
+            table.erase_if([](const string&, const CacheItem&) { return false; }, 1);
+        }
+        try {
+            table.insert(scratchKey, move(item));
+        }
+        catch (const overflow_error&) {
+            out += "SERVER_ERROR out of memory storing object\r\n";
+            return;
+        }
+        memoryUsed += bytes;
+        if (!noreply) {
+            out += "STORED\r\n";
+        }
+    }
+
+    void remove(string_view rest, string& out) {
+        string_view key = nextToken(rest);
+        string_view option = nextToken(rest);
+        bool noreply = option == "noreply";
+        if (key.empty() || (!option.empty() && !noreply) || !nextToken(rest).empty()) {
+            out += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+        CacheItem* item = lookup(key, time(nullptr));
+        if (item != nullptr) {
+            memoryUsed -= itemBytes(scratchKey, *item);
+            table.remove(scratchKey);
+        }
+        if (!noreply) {
+            out += item != nullptr ? "DELETED\r\n" : "NOT_FOUND\r\n";
+        }
+    }
+
+    // incr adds with 64-bit wraparound; decr stops at zero, as memcached does.
+    void adjust(string_view rest, bool increment, string& out) {
+        string_view key = nextToken(rest);
+        uint64_t delta;
+        if (key.empty() || !parseNumber(nextToken(rest), delta)) {
+            out += "CLIENT_ERROR invalid numeric delta argument\r\n";
+            return;
+        }
+        bool noreply = nextToken(rest) == "noreply";
+        CacheItem* item = lookup(key, time(nullptr));
+        if (item == nullptr) {
+            if (!noreply) {
+                out += "NOT_FOUND\r\n";
+            }
+            return;
+        }
+        uint64_t number;
+        if (!parseNumber(string_view(item->data), number)) {
+            out += "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n";
+            return;
+        }
+        number = increment ? number + delta : (delta > number ? 0 : number - delta);
+        string text = to_string(number);
+        memoryUsed += text.size();
+        memoryUsed -= item->data.size();
+        item->data = text;
+        item->cas = nextCas++;
+        item->referenced = true;
+        if (!noreply) {
+            out += text;
+            out += "\r\n";
+        }
+    }
+
+    void stats(string& out) {
+        auto stat = [&](const char* name, uint64_t value) {
+            out += "STAT ";
+            out += name;
+            out += ' ';
+            out += to_string(value);
+            out += "\r\n";
+        };
+        stat("curr_items", table.getSize());
+        stat("bytes", memoryUsed);
+        stat("limit_maxbytes", memoryLimit);
+        stat("cmd_get", getHits + getMisses);
+        stat("get_hits", getHits);
+        stat("get_misses", getMisses);
+        stat("cmd_set", sets);
+        stat("evictions", evictions);
+        stat("syscalls", syscalls == nullptr ? 0 : *syscalls);
+        out += "END\r\n";
+    }
+
+public:
+    MemcachedProcessor(HashTableLinearProbing<string, CacheItem>& table, size_t maxItems, size_t memoryLimit)
+        : table(table), maxItems(max<size_t>(maxItems, 1)), memoryLimit(memoryLimit) {
+        // Deletes leave tombstones. Purge them before they can take the slots that eviction keeps
+        // free, which is everything above maxItems; set() sweeps them out before inserting if they do.
+        double headroom = 1.0 - static_cast<double>(this->maxItems) / max(1, table.getCapacity());
+        table.setCompactionPolicy(0, min(0.25, max(0.01, headroom / 2)));
+    }
+
+    uint64_t getOperationCount() const { return operations; }
+    uint64_t getEvictionCount() const { return evictions; }
+    void attachSyscallCounter(const uint64_t* counter) { syscalls = counter; }
+
+    // Executes every complete command in data, including the data block of a set, and returns the
+    // bytes consumed. A set whose block has not fully arrived is left for the next call.
+    size_t processBuffer(const char* data, size_t length, string& out) {
+        size_t consumed = 0;
+        while (consumed < length) {
+            const char* newline = static_cast<const char*>(memchr(data + consumed, '\n', length - consumed));
+            if (newline == nullptr) {
+                break;
+            }
+            size_t next = newline - data + 1;
+            string_view line(data + consumed, newline - (data + consumed));
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            string_view rest = line;
+            string_view name = nextToken(rest);
+            const CommandCode* code = commandCodes.find(name);
+            if (name.empty()) {
+                consumed = next;
+                continue;
+            }
+            operations++;
+            if (code == nullptr) {
+                out += "ERROR\r\n";
+                consumed = next;
+                continue;
+            }
+
+            switch (*code) {
+            case GetCommand:
+            case GetsCommand:
+                get(rest, *code == GetsCommand, out);
+                break;
+            case SetCommand: {
+                string_view key = nextToken(rest);
+                uint32_t flags;
+                int64_t exptime;
+                size_t bytes;
+                bool valid = parseNumber(nextToken(rest), flags) && parseNumber(nextToken(rest), exptime)
+                    && parseNumber(nextToken(rest), bytes);
+                string_view option = nextToken(rest);
+                bool noreply = option == "noreply";
+                if (!valid || key.empty() || (!option.empty() && !noreply)) {
+                    out += "CLIENT_ERROR bad command line format\r\n";
+                    break;
+                }
+                if (bytes > memoryTarget()) {
+                    // Refused before anything is read into an item. A block small enough to arrive
+                    // is dropped once it has, as memcached does; a larger one is not waited for.
+                    if (bytes <= maxSkippedBlock) {
+                        if (bytes > length - next || length - next - bytes < 2) {
+                            operations--;
+                            return consumed;
+                        }
+                        next += bytes + 2;
+                    }
+                    out += "SERVER_ERROR object too large for cache\r\n";
+                    break;
+                }
+                if (bytes > length - next || length - next - bytes < 2) {
+                    operations--;
+                    return consumed;   // Wait for the rest of the data block.
+                }
+                string_view block(data + next, bytes);
+                bool terminated = data[next + bytes] == '\r' && data[next + bytes + 1] == '\n';
+                next += bytes + 2;
+                if (key.size() > maxKeyLength) {
+                    out += "CLIENT_ERROR key too long\r\n";
+                }
+                else if (!terminated) {
+                    out += "CLIENT_ERROR bad data chunk\r\n";
+                }
+                else {
+                    set(key, flags, exptime, block, noreply, out);
+                }
+                break;
+            }
+            case DeleteCommand:
+                remove(rest, out);
+                break;
+            case IncrCommand:
+            case DecrCommand:
+                adjust(rest, *code == IncrCommand, out);
+                break;
+            case StatsCommand:
+                stats(out);
+                break;
+            case VersionCommand:
+                out += "VERSION 1.6.0-hashtable\r\n";
+                break;
+            }
+            consumed = next;
+        }
+        return consumed;
+    }
+};
+
+// Builds a HashTableLinearProbing snapshot from more input than fits in memory, without ever
+// holding the table. add() streams each entry into one of a set of spill files by home slot
+// range: the home slot is hash % capacity rather than a hash prefix, so partitioning by slot range
+// is what keeps every partition's probe runs together. finish() then takes the partitions one at a
+// time, lays out their slots in memory with the same linear probing and overwrite rules insert()
+// follows, and appends them to the snapshot with sequential writes.
+//
+// Entries that probe past the end of a partition's range are carried into the next one. The last
+// partition wraps around to slot 0, so the first partition is written last. A key always lands in
+// the same partition, so duplicates keep the last value added, as with insert(). The output loads
+// with HashTableLinearProbing<K, V>::loadSnapshot.
+template<typename K, typename V>
+class ExternalSnapshotBuilder {
+private:
+    struct Record {
+        uint64_t hashValue;
+        K key;
+        V value;
+    };
+
+    string spillPrefix;
+    int capacity;
+    int partitionCount;
+    vector<unique_ptr<ofstream>> spills;
+    uint64_t spilledBytes = 0;
+    uint64_t added = 0;
+
+    string spillPath(int partition) const { return spillPrefix + ".part-" + to_string(partition); }
+
+    int firstSlot(int partition) const {
+        return static_cast<int>(static_cast<long long>(capacity) * partition / partitionCount);
+    }
+
+public:
+    // Spill files are named spillPrefix.part-N. partitions is clamped to [1, capacity].
+    ExternalSnapshotBuilder(const string& spillPrefix, int capacity, int partitions = 64)
+        : spillPrefix(spillPrefix), capacity(capacity), partitionCount(max(1, min(partitions, capacity))) {
+        if (capacity <= 0) {
+            throw invalid_argument("Capacity must be positive");
+        }
+        for (int partition = 0; partition < partitionCount; ++partition) {
+            spills.emplace_back(new ofstream(spillPath(partition), ios::binary | ios::trunc));
+            if (!*spills.back()) {
+                throw runtime_error("Cannot create spill file " + spillPath(partition));
+            }
+        }
+    }
+
+    ExternalSnapshotBuilder(const ExternalSnapshotBuilder&) = delete;
+    ExternalSnapshotBuilder& operator=(const ExternalSnapshotBuilder&) = delete;
+
+    ~ExternalSnapshotBuilder() {
+        spills.clear();
+        for (int partition = 0; partition < partitionCount; ++partition) {
+            std::remove(spillPath(partition).c_str());
+        }
+    }
+
+    void add(const K& key, const V& value) {
+        uint64_t hashValue = static_cast<uint64_t>(hash<K>()(key));
+        int home = static_cast<int>(hashValue % static_cast<uint64_t>(capacity));
+        int partition = static_cast<int>(static_cast<long long>(home) * partitionCount / capacity);
+        while (partition + 1 < partitionCount && firstSlot(partition + 1) <= home) {
+            partition++;   // Rounding can leave home just past the estimate's range
+        }
+        ostream& out = *spills[partition];
+        writeBinary(out, hashValue);
+        writeBinary(out, key);
+        writeBinary(out, value);
+        added++;
+    }
+
+    // Bytes written to the spill files; known once finish() has flushed them.
+    uint64_t getSpilledBytes() const { return spilledBytes; }
+    uint64_t getAddedCount() const { return added; }
+    int getPartitionCount() const { return partitionCount; }
+
+    // Writes the snapshot to out, which must be seekable: the entry count is patched into the
+    // header at the end. Returns the number of distinct keys. Throws overflow_error when they do
+    // not fit in capacity.
+    int finish(ostream& out) {
+        for (auto& spill : spills) {
+            if (!spill->flush()) {
+                throw runtime_error("Cannot write spill files");
+            }
+            spilledBytes += static_cast<uint64_t>(static_cast<long long>(spill->tellp()));
+        }
+        spills.clear();
+
+        writeSnapshotHeader(out, ProbingTableSnapshot);
+        writeBinary(out, LinearProbe::id);
+        writeBinary(out, static_cast<int32_t>(capacity));
+        streampos countsAt = out.tellp();
+        writeBinary(out, static_cast<int32_t>(0));   // Size and occupied slots, patched below
+        writeBinary(out, static_cast<int32_t>(0));
+
+        vector<Record> carried;          // Entries that ran past the previous partition's range
+        vector<Record> firstPartition;   // Slots of partition 0, written once the wrap-around is known
+        vector<int> firstLayout;
+        long long total = 0;
+
+        for (int partition = 0; partition < partitionCount; ++partition) {
+            int first = firstSlot(partition);
+            int length = (partition + 1 == partitionCount ? capacity : firstSlot(partition + 1)) - first;
+
+            // layout[i] is the record in slot first + i, or -1. It grows past length when a probe
+            // run crosses the end of the range.
+            vector<Record> records = move(carried);
+            carried.clear();
+            vector<int> layout(max<size_t>(length, records.size()), -1);
+            for (int i = 0; i < static_cast<int>(records.size()); ++i) {
+                layout[i] = i;   // Carried entries fill the first slots of the range, in order
+            }
+
+            ifstream in(spillPath(partition), ios::binary);
+            Record record;
+            while (in.peek() != char_traits<char>::eof()) {
+                readBinary(in, record.hashValue);
+                readBinary(in, record.key);
+                readBinary(in, record.value);
+                size_t position = static_cast<size_t>(record.hashValue % static_cast<uint64_t>(capacity)) - first;
+                for (;; ++position) {
+                    if (position == layout.size()) {
+                        layout.push_back(-1);
+                    }
+                    if (layout[position] < 0) {
+                        layout[position] = static_cast<int>(records.size());
+                        records.push_back(move(record));
+                        total++;
+                        break;
+                    }
+                    Record& held = records[layout[position]];
+                    if (held.hashValue == record.hashValue && held.key == record.key) {
+                        held.value = move(record.value);   // Later duplicates win, as with insert()
+                        break;
+                    }
+                }
+            }
+            in.close();
+            std::remove(spillPath(partition).c_str());
+            if (total > capacity) {
+                throw overflow_error("Hash table is full");
+            }
+
+            // Slots past the range belong to the next partition (or, from the last, to the first).
+            for (size_t position = length; position < layout.size(); ++position) {
+                carried.push_back(move(records[layout[position]]));
+            }
+            layout.resize(min<size_t>(layout.size(), length));
+            if (partition == 0) {
+                firstPartition = move(records);
+                firstLayout = move(layout);
+                continue;
+            }
+            for (int i = 0; i < static_cast<int>(layout.size()); ++i) {
+                if (layout[i] >= 0) {
+                    const Record& entry = records[layout[i]];
+                    writeBinary(out, static_cast<int32_t>(first + i));
+                    writeBinary(out, static_cast<uint8_t>(1));
+                    writeBinary(out, entry.hashValue);
+                    writeBinary(out, entry.key);
+                    writeBinary(out, entry.value);
+                }
+            }
+        }
+
+        // Runs that wrapped around take the free slots at the start of partition 0. Filling a free
+        // slot never breaks another key's probe run; only running out of them would.
+        int position = 0;
+        for (Record& entry : carried) {
+            while (position < static_cast<int>(firstLayout.size()) && firstLayout[position] >= 0) {
+                position++;
+            }
+            if (position == static_cast<int>(firstLayout.size())) {
+                throw overflow_error("Probe runs wrapped past the first partition; use fewer partitions");
+            }
+            firstLayout[position] = static_cast<int>(firstPartition.size());
+            firstPartition.push_back(move(entry));
+        }
+        for (int i = 0; i < static_cast<int>(firstLayout.size()); ++i) {
+            if (firstLayout[i] >= 0) {
+                const Record& entry = firstPartition[firstLayout[i]];
+                writeBinary(out, static_cast<int32_t>(i));
+                writeBinary(out, static_cast<uint8_t>(1));
+                writeBinary(out, entry.hashValue);
+                writeBinary(out, entry.key);
+                writeBinary(out, entry.value);
+            }
+        }
+
+        streampos end = out.tellp();
+        out.seekp(countsAt);
+        writeBinary(out, static_cast<int32_t>(total));
+        writeBinary(out, static_cast<int32_t>(total));
+        out.seekp(end);
+        if (!out.flush()) {
+            throw runtime_error("Cannot write the snapshot");
+        }
+        return static_cast<int>(total);
+    }
+};
+
+// A radix-partitioned hash join. Both inputs are split into 2^radixBits partitions by the top
+// bits of their mixed key hash, sized so that one partition's build table fits in the L2 cache.
+// Worker threads then take partitions one at a time. Each builds a small HashTableLinearProbing
+// from the build rows and probes it with findBatch, so the random accesses of the join stay in
+// cache instead of missing all over one table the size of the build side.
+//
+// Build keys are taken to be unique, as for a primary key; a repeated build key keeps its last
+// payload. The partitioning is a histogram pass and a scatter pass per input, with every thread
+// writing its own stretch of each partition, so it needs no locks either.
+template<typename K, typename B, typename P>
+class RadixHashJoin {
+private:
+    static constexpr size_t cacheBytes = 256 << 10;   // Per-partition table budget (a typical L2)
+    static constexpr size_t probeGroup = 256;         // Probe keys handed to findBatch at a time
+
+    // One side after partitioning, in columns, so the probe keys can go to findBatch as they are.
+    template<typename Payload>
+    struct Partitioned {
+        vector<K> keys;
+        vector<Payload> payloads;
+        vector<size_t> starts;     // Partition p is [starts[p], starts[p + 1])
+    };
+
+    int threads;
+    int radixBits = 0;
+
+    int partitionOf(const K& key) const {
+        return radixBits == 0 ? 0 : static_cast<int>(mixHash(hash<K>()(key)) >> (64 - radixBits));
+    }
+
+    // Runs work(thread, first, last) over [0, count) split into one contiguous range per thread.
+    template<typename Work>
+    void forRanges(size_t count, Work work) const {
+        vector<thread> pool;
+        for (int t = 1; t < threads; ++t) {
+            pool.emplace_back(work, t, count * t / threads, count * (t + 1) / threads);
+        }
+        work(0, 0, count / threads);
+        for (auto& worker : pool) {
+            worker.join();
+        }
+    }
+
+    template<typename Payload>
+    Partitioned<Payload> partition(const vector<pair<K, Payload>>& rows) const {
+        int partitions = 1 << radixBits;
+        vector<vector<size_t>> histograms(threads, vector<size_t>(partitions, 0));
+        forRanges(rows.size(), [&](int t, size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                histograms[t][partitionOf(rows[i].first)]++;
+            }
+        });
+
+        // Turn the counts into each thread's write position in each partition.
+        Partitioned<Payload> out;
+        out.starts.assign(partitions + 1, 0);
+        size_t position = 0;
+        for (int p = 0; p < partitions; ++p) {
+            out.starts[p] = position;
+            for (int t = 0; t < threads; ++t) {
+                size_t count = histograms[t][p];
+                histograms[t][p] = position;
+                position += count;
+            }
+        }
+        out.starts[partitions] = position;
+        out.keys.resize(rows.size());
+        out.payloads.resize(rows.size());
+
+        forRanges(rows.size(), [&](int t, size_t first, size_t last) {
+            vector<size_t>& cursor = histograms[t];
+            for (size_t i = first; i < last; ++i) {
+                size_t at = cursor[partitionOf(rows[i].first)]++;
+                out.keys[at] = rows[i].first;
+                out.payloads[at] = rows[i].second;
+            }
+        });
+        return out;
+    }
+
+public:
+    explicit RadixHashJoin(int threads = max(1, static_cast<int>(thread::hardware_concurrency())))
+        : threads(max(1, threads)) {}
+
+    // Joins build and probe on their keys, calling emit(thread, key, buildPayload, probePayload)
+    // for every match. emit runs concurrently on the worker threads, which are numbered from 0 so
+    // it can keep per-thread results. Returns the number of matches.
+    template<typename Emit>
+    uint64_t join(const vector<pair<K, B>>& build, const vector<pair<K, P>>& probe, Emit emit) {
+        // Tables run at load 0.5, at roughly 32 bytes or more a slot.
+        size_t tableBytes = build.size() * 2 * max<size_t>(32, sizeof(K) + sizeof(B) + 16);
+        radixBits = 0;
+        while ((tableBytes >> radixBits) > cacheBytes && radixBits < 16) {
+            radixBits++;
+        }
+        Partitioned<B> buildSide = partition(build);
+        Partitioned<P> probeSide = partition(probe);
+
+        int partitions = 1 << radixBits;
+        atomic<int> nextPartition(0);
+        atomic<uint64_t> matches(0);
+        auto worker = [&](int t) {
+            const B* found[probeGroup];
+            uint64_t local = 0;
+            for (int p = nextPartition++; p < partitions; p = nextPartition++) {
+                size_t buildFirst = buildSide.starts[p], buildLast = buildSide.starts[p + 1];
+                if (buildFirst == buildLast) {
+                    continue;
+                }
+                HashTableLinearProbing<K, B> table(static_cast<int>(max<size_t>(16, (buildLast - buildFirst) * 2)));
+                for (size_t i = buildFirst; i < buildLast; ++i) {
+                    table.insert(buildSide.keys[i], buildSide.payloads[i]);
+                }
+                for (size_t first = probeSide.starts[p]; first < probeSide.starts[p + 1]; first += probeGroup) {
+                    size_t count = min(probeGroup, probeSide.starts[p + 1] - first);
+                    table.findBatch(&probeSide.keys[first], count, found);
+                    for (size_t i = 0; i < count; ++i) {
+                        if (found[i] != nullptr) {
+                            emit(t, probeSide.keys[first + i], *found[i], probeSide.payloads[first + i]);
+                            local++;
+                        }
+                    }
+                }
+            }
+            matches += local;
+        };
+
+        vector<thread> pool;
+        for (int t = 1; t < threads; ++t) {
+            pool.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto& t : pool) {
+            t.join();
+        }
+        return matches;
+    }
+
+    // The partition count the last join used.
+    int getPartitionCount() const { return 1 << radixBits; }
+};
+
+// The accumulator state of one group of a GROUP BY: sum, count, min and max of its values.
+struct GroupAggregate {
+    int64_t sum = 0;
+    int64_t count = 0;
+    int64_t minimum = numeric_limits<int64_t>::max();
+    int64_t maximum = numeric_limits<int64_t>::min();
+
+    void add(int64_t value) {
+        sum += value;
+        count++;
+        minimum = min(minimum, value);
+        maximum = max(maximum, value);
+    }
+
+    void merge(const GroupAggregate& other) {
+        sum += other.sum;
+        count += other.count;
+        minimum = min(minimum, other.minimum);
+        maximum = max(maximum, other.maximum);
+    }
+};
+
+// Hash aggregation: groups rows of (key, value) columns by key into a HashTableLinearProbing of
+// GroupAggregate. Each thread pre-aggregates its own range of rows into its own table, so the
+// threads share nothing while they run, and the tables are merged pairwise at the end, half of
+// them in parallel each round. Rows go through in vectors of 1024: findOrInsertBatch hashes and
+// prefetches the keys of a vector and finds their slots, and a second loop then folds the values
+// into the slots it found.
+template<typename K>
+class HashAggregator {
+private:
+    static constexpr size_t vectorRows = 1024;
+
+    int groupCapacity;
+    int threads;
+
+public:
+    // groupCapacity is the slot count of each thread's table, so it has to allow for every group.
+    HashAggregator(int groupCapacity, int threads = max(1, static_cast<int>(thread::hardware_concurrency())))
+        : groupCapacity(groupCapacity), threads(max(1, threads)) {}
+
+    // Aggregates rows rows and returns the table of groups. Throws overflow_error when there are
+    // more groups than groupCapacity allows.
+    HashTableLinearProbing<K, GroupAggregate> aggregate(const K* keys, const int64_t* values, size_t rows) const {
+        int workers = static_cast<int>(max<size_t>(1, min(static_cast<size_t>(threads), rows / vectorRows)));
+        vector<HashTableLinearProbing<K, GroupAggregate>> tables;
+        tables.reserve(workers);
+        for (int t = 0; t < workers; ++t) {
+            tables.emplace_back(groupCapacity);
+        }
+
+        vector<exception_ptr> errors(workers);
+        auto run = [&](int t) {
+            try {
+                GroupAggregate* slots[vectorRows];
+                size_t last = rows * (t + 1) / workers;
+                for (size_t first = rows * t / workers; first < last; first += vectorRows) {
+                    size_t count = min(vectorRows, last - first);
+                    tables[t].findOrInsertBatch(keys + first, count, slots);
+                    for (size_t i = 0; i < count; ++i) {
+                        slots[i]->add(values[first + i]);
+                    }
+                }
+            }
+            catch (...) {
+                errors[t] = current_exception();
+            }
+        };
+        auto merge = [&](int t, int step) {
+            try {
+                tables[t].mergeWith(tables[t + step], [](GroupAggregate& mine, const GroupAggregate& theirs) { mine.merge(theirs); });
+            }
+            catch (...) {
+                errors[t] = current_exception();
+            }
+        };
+
+        vector<thread> pool;
+        for (int t = 1; t < workers; ++t) {
+            pool.emplace_back(run, t);
+        }
+        run(0);
+        for (auto& worker : pool) {
+            worker.join();
+        }
+        for (int step = 1; step < workers; step *= 2) {
+            pool.clear();
+            for (int t = step * 2; t + step < workers; t += step * 2) {
+                pool.emplace_back(merge, t, step);
+            }
+            merge(0, step);
+            for (auto& worker : pool) {
+                worker.join();
+            }
+        }
+        for (const exception_ptr& error : errors) {
+            if (error) {
+                rethrow_exception(error);
+            }
+        }
+        return move(tables[0]);
+    }
+};
+
+
+// Command-line options of the non-interactive modes.
+struct DriverOptions {
+    bool batch = false;         // --batch [file]: run commands from a file or stdin
+    string batchFile;           // Empty or "-" reads stdin
+    string recordFile;          // --record file: copy the executed batch input to a trace
+    string replayFile;          // --replay file: time a recorded trace
+    int capacity = 15000;       // --capacity N
+    bool serve = false;         // --serve path: run a server on a Unix domain socket
+    bool loadgen = false;       // --loadgen path: drive a running server
+    string socketPath;
+    int connections = 4;        // --connections N (load generator)
+    int requests = 100000;      // --requests N per connection (load generator)
+    int pipeline = 16;          // --pipeline N requests in flight per connection (load generator)
+    int keySpace = 10000;       // --keys N distinct keys (load generator)
+    string backend = "epoll";   // --backend epoll|io_uring (server)
+    bool compareBackends = false;   // --compare-backends: benchmark both backends in-process
+    bool memcachedCheck = false;    // --memcached-check: send malformed requests to an in-process memcached server
+    bool memcached = false;     // --memcached port|path: serve the memcached text protocol
+    int maxItems = 0;           // --max-items N before eviction (memcached; default 80% of capacity)
+    int memoryMegabytes = 64;   // --memory MB before eviction (memcached)
+    bool sharded = false;       // --sharded port: thread-per-core server on a loopback port
+    bool scalingReport = false; // --scaling-report: benchmark the sharded server at 1, 2, 4, ... reactors
+    int port = 11400;           // Loopback port of the sharded server
+    int reactors = max(1, static_cast<int>(thread::hardware_concurrency()));  // --reactors N
+    bool sharedWriter = false;  // --shm-writer name: create and update a shared memory table
+    bool sharedReader = false;  // --shm-reader name: look keys up in a writer's table
+    string sharedName;          // POSIX shared memory name, e.g. /hashtable
+    string loadFile;            // --load file of "key value" lines for the shared writer
+    int clusterNodes = 0;       // --cluster N: router benchmark over N node processes
+    int replicaCount = 0;       // --replicate N: replication benchmark with N replica processes
+    string bitcaskDirectory;    // --bitcask dir: persistent store benchmark in dir
+    int valueBytes = 1024;      // --value-size N bytes per value (bitcask)
+    string pagedFile;           // --paged file: out-of-core table benchmark, with --memory MB of buffer pool
+    string externalSnapshot;    // --external-build snapshot: build a snapshot from --load input via spill files
+    int joinRows = 0;           // --join N: hash join benchmark with N build rows
+    int groupRows = 0;          // --group-by N: hash aggregation benchmark over N rows
+};
+
+// Parses the command line; throws invalid_argument on anything it does not recognise.
+inline DriverOptions parseDriverOptions(int argc, char** argv) {
+    DriverOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string argument = argv[i];
+        bool hasValue = i + 1 < argc && argv[i + 1][0] != '-';
+        if (argument == "--batch") {
+            options.batch = true;
+            if (hasValue || (i + 1 < argc && string(argv[i + 1]) == "-")) {
+                options.batchFile = argv[++i];
+            }
+        }
+        else if (argument == "--record" && hasValue) {
+            options.recordFile = argv[++i];
+        }
+        else if (argument == "--replay" && hasValue) {
+            options.replayFile = argv[++i];
+        }
+        else if (argument == "--capacity" && hasValue) {
+            options.capacity = stoi(argv[++i]);
+        }
+        else if ((argument == "--serve" || argument == "--loadgen" || argument == "--memcached") && hasValue) {
+            (argument == "--serve" ? options.serve : argument == "--loadgen" ? options.loadgen : options.memcached) = true;
+            options.socketPath = argv[++i];
+        }
+        else if (argument == "--sharded" && hasValue) {
+            options.sharded = true;
+            options.port = stoi(argv[++i]);
+        }
+        else if ((argument == "--shm-writer" || argument == "--shm-reader") && i + 1 < argc) {
+            (argument == "--shm-writer" ? options.sharedWriter : options.sharedReader) = true;
+            options.sharedName = argv[++i];
+            if (options.sharedName[0] != '/') {
+                options.sharedName = "/" + options.sharedName;
+            }
+        }
+        else if (argument == "--replicate" && hasValue) {
+            options.replicaCount = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--cluster" && hasValue) {
+            options.clusterNodes = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--bitcask" && hasValue) {
+            options.bitcaskDirectory = argv[++i];
+        }
+        else if (argument == "--group-by" && hasValue) {
+            options.groupRows = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--join" && hasValue) {
+            options.joinRows = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--external-build" && hasValue) {
+            options.externalSnapshot = argv[++i];
+        }
+        else if (argument == "--paged" && hasValue) {
+            options.pagedFile = argv[++i];
+        }
+        else if (argument == "--value-size" && hasValue) {
+            options.valueBytes = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--load" && hasValue) {
+            options.loadFile = argv[++i];
+        }
+        else if (argument == "--scaling-report") {
+            options.scalingReport = true;
+        }
+        else if (argument == "--reactors" && hasValue) {
+            options.reactors = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--max-items" && hasValue) {
+            options.maxItems = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--memory" && hasValue) {
+            options.memoryMegabytes = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--connections" && hasValue) {
+            options.connections = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--requests" && hasValue) {
+            options.requests = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--pipeline" && hasValue) {
+            options.pipeline = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--keys" && hasValue) {
+            options.keySpace = max(1, stoi(argv[++i]));
+        }
+        else if (argument == "--backend" && hasValue && (string(argv[i + 1]) == "epoll" || string(argv[i + 1]) == "io_uring")) {
+            options.backend = argv[++i];
+        }
+        else if (argument == "--memcached-check") {
+            options.memcachedCheck = true;
+        }
+        else if (argument == "--compare-backends") {
+            options.compareBackends = true;
+        }
+        else {
+            throw invalid_argument("Unknown or incomplete option: " + argument);
+        }
+    }
+    return options;
+}
+
+// Runs --batch: replies go to stdout, the throughput summary to stderr so pipes stay clean.
+inline int runBatchMode(const DriverOptions& options) {
+    ios::sync_with_stdio(false);
+    HashTableLinearProbing<string, int> table(options.capacity);
+    CommandProcessor processor(table);
+
+    ifstream file;
+    istream* in = &cin;
+    if (!options.batchFile.empty() && options.batchFile != "-") {
+        file.open(options.batchFile, ios::binary);
+        if (!file) {
+            cerr << "Cannot open " << options.batchFile << endl;
+            return 1;
+        }
+        in = &file;
+    }
+    ofstream record;
+    if (!options.recordFile.empty()) {
+        record.open(options.recordFile, ios::binary);
+        if (!record) {
+            cerr << "Cannot open " << options.recordFile << endl;
+            return 1;
+        }
+    }
+
+    auto start = high_resolution_clock::now();
+    processor.run(*in, cout, record.is_open() ? &record : nullptr);
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+    cerr << "Processed " << processor.getOperationCount() << " commands in " << seconds << " s ("
+         << processor.getOperationCount() / seconds << " ops/sec)\n";
+    return 0;
+}
+
+// Runs --replay: loads the whole trace first so the timing covers only command execution.
+inline int runReplayMode(const DriverOptions& options) {
+    ifstream file(options.replayFile, ios::binary);
+    if (!file) {
+        cerr << "Cannot open " << options.replayFile << endl;
+        return 1;
+    }
+    string trace((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    HashTableLinearProbing<string, int> table(options.capacity);
+    CommandProcessor processor(table);
+    string replies;
+    replies.reserve(1 << 16);
+    size_t errors = 0;
+
+    auto start = high_resolution_clock::now();
+    size_t consumed = 0;
+    while (consumed < trace.size()) {
+        size_t chunk = min(trace.size() - consumed, static_cast<size_t>(1 << 16));
+        size_t used = processor.processBuffer(trace.data() + consumed, chunk, replies);
+        if (used == 0) {
+            // A line longer than the chunk, or a final line without a newline.
+            const char* newline = static_cast<const char*>(memchr(trace.data() + consumed, '\n', trace.size() - consumed));
+            used = newline == nullptr ? trace.size() - consumed : newline - (trace.data() + consumed) + 1;
+            processor.processLine(string_view(trace.data() + consumed, newline == nullptr ? used : used - 1), replies);
+        }
+        consumed += used;
+        for (size_t at = replies.find("ERROR"); at != string::npos; at = replies.find("ERROR", at + 1)) {
+            errors++;
+        }
+        replies.clear();
+    }
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+
+    cout << "Replayed " << processor.getOperationCount() << " commands in " << seconds << " s ("
+         << processor.getOperationCount() / seconds << " ops/sec), " << errors << " errors, "
+         << table.getSize() << " keys at the end\n";
+    return 0;
+}
+
+// Runs --external-build: streams "key value" lines from --load (or --keys synthetic ones, with a
+// few repeated keys) through ExternalSnapshotBuilder, with about --memory MB per partition, and
+// reports the throughput of each pass. Synthetic inputs are also built the ordinary way, to
+// compare the time and check that both snapshots hold the same entries.
+inline int runExternalBuildMode(const DriverOptions& options) {
+    string inputPath = options.loadFile;
+    bool synthetic = inputPath.empty();
+    int capacity = options.capacity;
+    if (synthetic) {
+        inputPath = options.externalSnapshot + ".input";
+        capacity = max(capacity, options.keySpace / 3 * 4 + 1);
+        ofstream input(inputPath, ios::binary | ios::trunc);
+        mt19937 rng(42);
+        for (int i = 0; i < options.keySpace + options.keySpace / 100; ++i) {
+            int key = i < options.keySpace ? i : static_cast<int>(rng() % options.keySpace);   // The tail repeats some keys
+            input << "key" << mixHash(key) % 1000000007 << "-" << key << ' ' << static_cast<int>(rng() % 1000000) << '\n';
+        }
+    }
+    ifstream input(inputPath, ios::binary);
+    if (!input) {
+        cerr << "Cannot open " << inputPath << endl;
+        return 1;
+    }
+    input.seekg(0, ios::end);
+    double inputBytes = static_cast<double>(input.tellg());
+    input.seekg(0);
+
+    // Calls fn(key, value) for each "key value" line, parsing a block at a time; istream's >> is
+    // several times slower and would dominate the partition pass.
+    auto forEachLine = [&input](auto fn) {
+        input.clear();
+        input.seekg(0);
+        vector<char> block(1 << 20);
+        size_t kept = 0;
+        string key;
+        while (true) {
+            input.read(block.data() + kept, static_cast<streamsize>(block.size() - kept));
+            size_t filled = kept + static_cast<size_t>(input.gcount());
+            bool last = filled < block.size();
+            const char* line = block.data();
+            const char* end = block.data() + filled;
+            while (line < end) {
+                const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+                if (newline == nullptr && !last) {
+                    break;
+                }
+                const char* stop = newline == nullptr ? end : newline;
+                const char* space = static_cast<const char*>(memchr(line, ' ', stop - line));
+                int value;
+                if (space != nullptr && from_chars(space + 1, stop, value).ec == errc()) {
+                    key.assign(line, space);
+                    fn(key, value);
+                }
+                line = newline == nullptr ? end : newline + 1;
+            }
+            if (last) {
+                break;
+            }
+            kept = static_cast<size_t>(end - line);
+            if (kept == block.size()) {
+                block.resize(block.size() * 2);   // A line longer than the block
+            }
+            memmove(block.data(), line, kept);
+        }
+    };
+
+    // About 64 bytes of layout and record per slot, plus the keys.
+    long long budget = static_cast<long long>(options.memoryMegabytes) << 20;
+    int partitions = static_cast<int>(max<long long>(4, (static_cast<long long>(capacity) * 96 + budget - 1) / budget));
+    auto start = high_resolution_clock::now();
+    int distinct;
+    double partitionSeconds, buildSeconds, outputBytes;
+    uint64_t spilled;
+    {
+        ExternalSnapshotBuilder<string, int> builder(options.externalSnapshot, capacity, partitions);
+        forEachLine([&](const string& key, int value) { builder.add(key, value); });
+        partitionSeconds = duration<double>(high_resolution_clock::now() - start).count();
+        ofstream out(options.externalSnapshot, ios::binary | ios::trunc);
+        distinct = builder.finish(out);
+        outputBytes = static_cast<double>(out.tellp());
+        spilled = builder.getSpilledBytes();
+        buildSeconds = duration<double>(high_resolution_clock::now() - start).count() - partitionSeconds;
+    }
+    double gigabyte = 1e9;
+    cout << "External build of " << distinct << " keys into " << capacity << " slots with " << partitions << " partitions:\n"
+         << "  partition pass: " << inputBytes / gigabyte << " GB in, " << spilled / gigabyte << " GB spilled, "
+         << inputBytes / gigabyte / partitionSeconds << " GB/s\n"
+         << "  build pass: " << outputBytes / gigabyte << " GB snapshot, "
+         << (spilled + outputBytes) / gigabyte / buildSeconds << " GB/s read and written\n"
+         << "  total: " << partitionSeconds + buildSeconds << " s, " << inputBytes / gigabyte / (partitionSeconds + buildSeconds)
+         << " GB/s of input\n";
+
+    if (synthetic) {
+        start = high_resolution_clock::now();
+        HashTableLinearProbing<string, int> table(capacity);
+        forEachLine([&](const string& key, int value) { table.insert(key, value); });
+        ofstream out(options.externalSnapshot + ".direct", ios::binary | ios::trunc);
+        table.saveSnapshot(out);
+        out.close();
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        std::remove((options.externalSnapshot + ".direct").c_str());
+
+        ifstream built(options.externalSnapshot, ios::binary);
+        auto loaded = HashTableLinearProbing<string, int>::loadSnapshot(built);
+        int mismatches = abs(loaded.getSize() - table.getSize());
+        table.for_each([&](const string& k, int v) {
+            const int* found = loaded.find(k);
+            mismatches += found == nullptr || *found != v;
+        });
+        cout << "Building with insert and saveSnapshot took " << seconds << " s; the snapshots differ in " << mismatches << " entries\n";
+        std::remove(inputPath.c_str());
+    }
+    return 0;
+}
+
+// Runs --join N: joins N build rows with unique keys against 4N probe rows, about half of which
+// find a match, first with one table of the whole build side and then with RadixHashJoin on
+// 1, 2, 4, ... threads.
+inline int runJoinMode(const DriverOptions& options) {
+    size_t buildRows = static_cast<size_t>(options.joinRows);
+    mt19937_64 rng(42);
+    vector<pair<uint64_t, uint64_t>> build(buildRows), probe(buildRows * 4);
+    for (size_t i = 0; i < buildRows; ++i) {
+        build[i] = make_pair(mixHash(i), rng());
+    }
+    shuffle(build.begin(), build.end(), rng);
+    for (auto& row : probe) {
+        uint64_t pick = rng() % buildRows;
+        row = make_pair(rng() % 2 == 0 ? mixHash(pick) : mixHash(buildRows + pick), rng());
+    }
+    double rows = static_cast<double>(build.size() + probe.size());
+
+    auto start = high_resolution_clock::now();
+    HashTableLinearProbing<uint64_t, uint64_t> table(static_cast<int>(buildRows * 2));
+    for (const auto& row : build) {
+        table.insert(row.first, row.second);
+    }
+    uint64_t expectedMatches = 0, expectedChecksum = 0;
+    for (const auto& row : probe) {
+        const uint64_t* found = table.find(row.first);
+        if (found != nullptr) {
+            expectedMatches++;
+            expectedChecksum += *found ^ row.second;
+        }
+    }
+    double naiveSeconds = duration<double>(high_resolution_clock::now() - start).count();
+    cout << "Joining " << build.size() << " build rows with " << probe.size() << " probe rows\n"
+         << "One table: " << naiveSeconds << " s, " << rows / naiveSeconds << " rows/sec, " << expectedMatches << " matches\n";
+
+    int hardware = max(1, static_cast<int>(thread::hardware_concurrency()));
+    vector<int> threadCounts;
+    for (int threads = 1; threads < hardware; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(hardware);
+    for (int threads : threadCounts) {
+        RadixHashJoin<uint64_t, uint64_t, uint64_t> join(threads);
+        vector<uint64_t> checksums(threads * 8, 0);   // Eight apart, a cache line per thread
+        start = high_resolution_clock::now();
+        uint64_t matches = join.join(build, probe, [&](int t, uint64_t, uint64_t buildPayload, uint64_t probePayload) {
+            checksums[t * 8] += buildPayload ^ probePayload;
+        });
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        uint64_t checksum = 0;
+        for (uint64_t value : checksums) {
+            checksum += value;
+        }
+        cout << "Radix join, " << threads << " thread(s), " << join.getPartitionCount() << " partitions: " << seconds << " s, "
+             << rows / seconds << " rows/sec (" << naiveSeconds / seconds << "x), " << matches << " matches"
+             << (matches == expectedMatches && checksum == expectedChecksum ? "" : " -- MISMATCH") << "\n";
+    }
+    return 0;
+}
+
+// Runs --group-by N: aggregates N rows of random values by key for a range of group counts,
+// first a row at a time through findOrInsert on one thread, then with HashAggregator on
+// 1, 2, 4, ... threads, and checks the results agree.
+inline int runGroupByMode(const DriverOptions& options) {
+    size_t rows = static_cast<size_t>(options.groupRows);
+    mt19937_64 rng(42);
+    vector<int64_t> values(rows);
+    for (auto& value : values) {
+        value = static_cast<int64_t>(rng() % 2000001) - 1000000;
+    }
+    int hardware = max(1, static_cast<int>(thread::hardware_concurrency()));
+    vector<int> threadCounts;
+    for (int threads = 1; threads < hardware; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(hardware);
+
+    vector<uint64_t> keys(rows);
+    for (uint64_t groups : { uint64_t(16), uint64_t(1) << 10, uint64_t(1) << 16, uint64_t(1) << 20 }) {
+        if (groups > rows) {
+            break;
+        }
+        for (auto& key : keys) {
+            key = mixHash(rng() % groups);
+        }
+        int capacity = static_cast<int>(groups * 2);
+
+        auto start = high_resolution_clock::now();
+        HashTableLinearProbing<uint64_t, GroupAggregate> expected(capacity);
+        for (size_t i = 0; i < rows; ++i) {
+            expected.findOrInsert(keys[i]).add(values[i]);
+        }
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        cout << groups << " groups: row at a time " << rows / seconds << " rows/sec";
+
+        for (int threads : threadCounts) {
+            HashAggregator<uint64_t> aggregator(capacity, threads);
+            start = high_resolution_clock::now();
+            auto result = aggregator.aggregate(keys.data(), values.data(), rows);
+            seconds = duration<double>(high_resolution_clock::now() - start).count();
+            bool same = result.getSize() == expected.getSize();
+            expected.for_each([&](const uint64_t& key, const GroupAggregate& group) {
+                const GroupAggregate* found = result.find(key);
+                same = same && found != nullptr && found->sum == group.sum && found->count == group.count
+                    && found->minimum == group.minimum && found->maximum == group.maximum;
+            });
+            cout << "; " << threads << " thread(s) " << rows / seconds << (same ? "" : " (MISMATCH)");
+        }
+        cout << "\n";
+    }
+    return 0;
+}
+
+// A bounded queue for exactly one producer thread and one consumer thread, with no locks: the
+// producer only writes tail and the consumer only writes head. Each side keeps a cached copy of
+// the other's index and only reloads it when the queue looks full or empty, so in steady state
+// neither side touches the other's cache line. Capacity is rounded up to a power of two.
+template<typename T>
+class SpscQueue {
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{ 0 };   // Next slot to pop; written by the consumer
+    size_t cachedTail = 0;                  // Consumer's last view of tail
+    alignas(64) atomic<size_t> tail{ 0 };   // Next slot to push; written by the producer
+    size_t cachedHead = 0;                  // Producer's last view of head
+
+public:
+    explicit SpscQueue(size_t capacity) : slots(nextPowerOfTwo(static_cast<int>(max<size_t>(capacity, 2)))), mask(slots.size() - 1) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side. Returns false, leaving value untouched, when the queue is full.
+    bool push(T&& value) {
+        size_t position = tail.load(memory_order_relaxed);
+        if (position - cachedHead == slots.size()) {
+            cachedHead = head.load(memory_order_acquire);
+            if (position - cachedHead == slots.size()) {
+                return false;
+            }
+        }
+        slots[position & mask] = move(value);
+        tail.store(position + 1, memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false when the queue is empty.
+    bool pop(T& value) {
+        size_t position = head.load(memory_order_relaxed);
+        if (position == cachedTail) {
+            cachedTail = tail.load(memory_order_acquire);
+            if (position == cachedTail) {
+                return false;
+            }
+        }
+        value = move(slots[position & mask]);
+        head.store(position + 1, memory_order_release);
+        return true;
+    }
+};
+
+#if defined(__linux__)
+// Opens a non-blocking listening Unix domain socket at path, replacing a stale socket file.
+inline int openUnixListener(const string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw invalid_argument("Socket path is too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw runtime_error(string("socket: ") + strerror(errno));
+    }
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        int error = errno;
+        close(fd);
+        throw runtime_error("Cannot listen on " + path + ": " + strerror(error));
+    }
+    return fd;
+}
+
+// Connects a blocking client socket to a Unix domain socket at path.
+inline int connectUnixSocket(const string& path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw invalid_argument("Socket path is too long: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw runtime_error("Cannot connect to " + path + ": " + strerror(error));
+    }
+    return fd;
+}
+
+// Opens a non-blocking listening TCP socket on the loopback interface. With reusePort several
+// sockets can listen on the same port and the kernel spreads incoming connections among them.
+inline int openTcpListener(int port, bool reusePort = false) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw runtime_error(string("socket: ") + strerror(errno));
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reusePort) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        int error = errno;
+        close(fd);
+        throw runtime_error("Cannot listen on port " + to_string(port) + ": " + strerror(error));
+    }
+    return fd;
+}
+
+// Connects a blocking client socket to a loopback TCP port, with Nagle's algorithm off.
+inline int connectTcpSocket(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw runtime_error("Cannot connect to port " + to_string(port) + ": " + strerror(error));
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+// Set from a signal handler to make the server loops return.
+inline atomic<bool> serverStopRequested(false);
+
+// A single-threaded event loop serving a listening socket with epoll. Each connection keeps its own
+// input and output buffers; every complete request in the input is handed to the protocol at once,
+// so clients may pipeline any number of requests without waiting for replies. The protocol is any
+// type with
+//     size_t processBuffer(const char* data, size_t length, string& out)
+// that executes the complete requests at the front of data, appends their replies to out and
+// returns the bytes consumed (CommandProcessor is one).
+template<typename Protocol>
+class EpollServer {
+private:
+    static constexpr size_t readChunk = 1 << 16;         // Bytes requested per read
+    static constexpr size_t outputLimit = 1 << 22;       // Stop reading a client with this much unsent
+    static constexpr size_t inputLimit = 1 << 22;        // Close a client whose unfinished request grows past this
+
+    struct Connection {
+        vector<char> input;     // Received bytes not yet consumed by the protocol
+        size_t filled = 0;
+        string output;          // Replies not yet written
+        size_t written = 0;
+        uint32_t interest = 0;  // Events currently registered with epoll
+    };
+
+    Protocol& protocol;
+    int listenFd;
+    int epollFd;
+    vector<unique_ptr<Connection>> connections;  // Indexed by file descriptor
+    uint64_t accepted = 0;
+    uint64_t syscalls = 0;                        // System calls made by the loop
+
+    void watch(int fd, uint32_t events, int operation) {
+        syscalls++;
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, operation, fd, &event) < 0) {
+            throw runtime_error(string("epoll_ctl: ") + strerror(errno));
+        }
+    }
+
+    void closeConnection(int fd) {
+        syscalls += 2;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections[fd].reset();
+    }
+
+    void acceptConnections() {
+        while (true) {
+            syscalls++;
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;  // EAGAIN, or a client that went away before we got to it
+            }
+            if (static_cast<size_t>(fd) >= connections.size()) {
+                connections.resize(fd + 1);
+            }
+            connections[fd] = make_unique<Connection>();
+            connections[fd]->interest = EPOLLIN;
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+            accepted++;
+        }
+    }
+
+    // Reads once (level-triggered epoll calls again if more is waiting) and runs the complete requests.
+    bool readFrom(int fd, Connection& connection) {
+        if (connection.input.size() - connection.filled < readChunk) {
+            connection.input.resize(connection.filled + readChunk);
+        }
+        syscalls++;
+        ssize_t received = read(fd, connection.input.data() + connection.filled, readChunk);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+            return false;
+        }
+        if (received < 0) {
+            return true;
+        }
+        connection.filled += received;
+        size_t consumed = protocol.processBuffer(connection.input.data(), connection.filled, connection.output);
+        memmove(connection.input.data(), connection.input.data() + consumed, connection.filled - consumed);
+        connection.filled -= consumed;
+        return connection.filled < inputLimit;   // A line that never ends would otherwise grow input forever
+    }
+
+    bool writeTo(int fd, Connection& connection) {
+        while (connection.written < connection.output.size()) {
+            syscalls++;
+            ssize_t sent = send(fd, connection.output.data() + connection.written,
+                connection.output.size() - connection.written, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            connection.written += sent;
+        }
+        if (connection.written == connection.output.size()) {
+            connection.output.clear();
+            connection.written = 0;
+        }
+        return true;
+    }
+
+    // Waits for output space only while replies are pending, and stops reading a client that is
+    // not collecting its replies.
+    void updateInterest(int fd, Connection& connection) {
+        size_t pending = connection.output.size() - connection.written;
+        uint32_t interest = (pending < outputLimit ? uint32_t(EPOLLIN) : 0u) | (pending > 0 ? uint32_t(EPOLLOUT) : 0u);
+        if (interest != connection.interest) {
+            watch(fd, interest, EPOLL_CTL_MOD);
+            connection.interest = interest;
+        }
+    }
+
+public:
+    // Takes ownership of a listening socket.
+    EpollServer(Protocol& protocol, int listenFd) : protocol(protocol), listenFd(listenFd) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            close(listenFd);
+            throw runtime_error(string("epoll_create1: ") + strerror(errno));
+        }
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    EpollServer(const EpollServer&) = delete;
+    EpollServer& operator=(const EpollServer&) = delete;
+
+    ~EpollServer() {
+        for (size_t fd = 0; fd < connections.size(); ++fd) {
+            if (connections[fd]) {
+                close(static_cast<int>(fd));
+            }
+        }
+        close(epollFd);
+        close(listenFd);
+    }
+
+    uint64_t getAcceptedCount() const { return accepted; }
+    const uint64_t* getSyscallCounter() const { return &syscalls; }
+
+    // Serves clients until stop becomes true (checked at least every 100 ms).
+    void run(const atomic<bool>& stop) {
+        epoll_event events[256];
+        while (!stop.load(memory_order_relaxed)) {
+            syscalls++;
+            int ready = epoll_wait(epollFd, events, 256, 100);
+            if (ready < 0 && errno != EINTR) {
+                throw runtime_error(string("epoll_wait: ") + strerror(errno));
+            }
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptConnections();
+                    continue;
+                }
+                Connection& connection = *connections[fd];
+                bool open = true;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    open = readFrom(fd, connection);
+                }
+                if (open && connection.written < connection.output.size()) {
+                    open = writeTo(fd, connection);
+                }
+                if (open) {
+                    updateInterest(fd, connection);
+                }
+                else {
+                    closeConnection(fd);
+                }
+            }
+        }
+    }
+};
+
+#if HASH_TABLE_HAS_IO_URING
+// A minimal io_uring instance driven through the raw system calls, so no liburing is needed.
+// Submission entries are prepared with getSqe() and published, together with a wait for
+// completions, by a single io_uring_enter call in submitAndWait().
+class IoUring {
+private:
+    int ringFd;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+    unsigned localTail = 0;     // Entries prepared, published or not
+
+    template<typename T>
+    static T* at(void* ring, unsigned offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+
+    void release() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        close(ringFd);
+    }
+
+public:
+    // Throws runtime_error when the kernel has no io_uring or it is disabled.
+    explicit IoUring(unsigned entries) {
+        io_uring_params params{};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) {
+            throw runtime_error(string("io_uring_setup: ") + strerror(errno));
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) {
+            sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing
+            : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            int error = errno;
+            release();
+            throw runtime_error(string("io_uring mmap: ") + strerror(error));
+        }
+        sqHead = at<unsigned>(sqRing, params.sq_off.head);
+        sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        sqMask = *at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        cqHead = at<unsigned>(cqRing, params.cq_off.head);
+        cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = *at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+        localTail = *sqTail;
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        release();
+    }
+
+    // Returns a zeroed submission entry, or nullptr when the submission queue is full.
+    io_uring_sqe* getSqe() {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (localTail - head >= sqEntries) {
+            return nullptr;
+        }
+        unsigned index = localTail & sqMask;
+        sqArray[index] = index;
+        localTail++;
+        memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        return &sqes[index];
+    }
+
+    // Publishes the prepared entries and waits until at least minComplete completions are ready.
+    // Returns the io_uring_enter result (-1 with errno set on failure, EINTR included).
+    int submitAndWait(unsigned minComplete) {
+        unsigned pending = localTail - *sqTail;
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, pending, minComplete,
+            minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    }
+
+    // Calls fn(cqe) for every ready completion and then releases them to the kernel.
+    template<typename Function>
+    void forEachCompletion(Function&& fn) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            fn(cqes[head & cqMask]);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+// The io_uring counterpart of EpollServer, with the same protocol interface. Receives, sends and
+// accepts are all submitted to the ring, and every pass of the loop publishes the new requests
+// and collects completions in one io_uring_enter call, so a busy server makes one system call
+// for many requests. Each connection keeps a receive posted; replies produced while a send is in
+// flight collect in a second buffer and go out together when that send completes.
+template<typename Protocol>
+class IoUringServer {
+private:
+    static constexpr unsigned queueEntries = 1024;
+    static constexpr size_t readChunk = 1 << 16;
+    static constexpr size_t outputLimit = 1 << 22;
+    static constexpr size_t inputLimit = 1 << 22;      // Close a client whose unfinished request grows past this
+    enum Operation : uint64_t { AcceptOperation, ReceiveOperation, SendOperation, TimeoutOperation };
+
+    struct Connection {
+        vector<char> input;     // Received bytes not yet consumed by the protocol
+        size_t filled = 0;
+        string output;          // Replies waiting for the current send to finish
+        string sending;         // Replies owned by the send in flight
+        size_t sent = 0;
+        bool receiving = false; // A receive is posted
+        bool closing = false;   // The peer is gone; close once no operation is in flight
+    };
+
+    IoUring ring;
+    Protocol& protocol;
+    int listenFd;
+    vector<unique_ptr<Connection>> connections;  // Indexed by file descriptor
+    __kernel_timespec tick{ 0, 100 * 1000 * 1000 };  // Wakes the loop to check the stop flag
+    uint64_t accepted = 0;
+    uint64_t syscalls = 0;
+
+    io_uring_sqe* nextSqe() {
+        io_uring_sqe* sqe = ring.getSqe();
+        while (sqe == nullptr) {   // Queue full: hand the prepared entries to the kernel first.
+            syscalls++;
+            ring.submitAndWait(0);
+            sqe = ring.getSqe();
+        }
+        return sqe;
+    }
+
+    static uint64_t tag(int fd, Operation operation) {
+        return (static_cast<uint64_t>(fd) << 8) | operation;
+    }
+
+    void postAccept() {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listenFd;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = tag(listenFd, AcceptOperation);
+    }
+
+    void postTimeout() {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&tick);
+        sqe->len = 1;
+        sqe->user_data = tag(0, TimeoutOperation);
+    }
+
+    void postReceive(int fd, Connection& connection) {
+        if (connection.input.size() - connection.filled < readChunk) {
+            connection.input.resize(connection.filled + readChunk);
+        }
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(connection.input.data() + connection.filled);
+        sqe->len = static_cast<uint32_t>(readChunk);
+        sqe->user_data = tag(fd, ReceiveOperation);
+        connection.receiving = true;
+    }
+
+    void postSend(int fd, Connection& connection) {
+        io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(connection.sending.data() + connection.sent);
+        sqe->len = static_cast<uint32_t>(connection.sending.size() - connection.sent);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = tag(fd, SendOperation);
+    }
+
+    // Starts sending the collected replies unless a send is already in flight.
+    void startSend(int fd, Connection& connection) {
+        if (connection.sending.empty() && !connection.output.empty()) {
+            swap(connection.sending, connection.output);
+            connection.sent = 0;
+            postSend(fd, connection);
+        }
+    }
+
+    // Closes a connection whose peer left once the kernel holds no buffer of it.
+    void closeIfIdle(int fd, Connection& connection) {
+        if (connection.closing && !connection.receiving && connection.sending.empty()) {
+            close(fd);
+            syscalls++;
+            connections[fd].reset();
+        }
+    }
+
+    void onAccept(int result) {
+        if (result >= 0) {
+            if (static_cast<size_t>(result) >= connections.size()) {
+                connections.resize(result + 1);
+            }
+            connections[result] = make_unique<Connection>();
+            postReceive(result, *connections[result]);
+            accepted++;
+        }
+        postAccept();
+    }
+
+    void onReceive(int fd, Connection& connection, int result) {
+        connection.receiving = false;
+        if (result == -EINTR || result == -EAGAIN) {
+            postReceive(fd, connection);
+            return;
+        }
+        if (result <= 0) {
+            connection.closing = true;
+            closeIfIdle(fd, connection);
+            return;
+        }
+        connection.filled += result;
+        size_t consumed = protocol.processBuffer(connection.input.data(), connection.filled, connection.output);
+        memmove(connection.input.data(), connection.input.data() + consumed, connection.filled - consumed);
+        connection.filled -= consumed;
+        if (connection.filled >= inputLimit) {
+            connection.closing = true;
+            closeIfIdle(fd, connection);
+            return;
+        }
+        startSend(fd, connection);
+        if (connection.output.size() < outputLimit) {
+            postReceive(fd, connection);
+        }
+    }
+
+    void onSend(int fd, Connection& connection, int result) {
+        if (result < 0 && result != -EINTR && result != -EAGAIN) {
+            connection.sending.clear();
+            connection.output.clear();
+            connection.closing = true;
+            closeIfIdle(fd, connection);
+            return;
+        }
+        connection.sent += max(result, 0);
+        if (connection.sent < connection.sending.size()) {
+            postSend(fd, connection);
+            return;
+        }
+        connection.sending.clear();
+        if (connection.closing) {
+            closeIfIdle(fd, connection);
+            return;
+        }
+        startSend(fd, connection);
+        if (!connection.receiving && connection.output.size() < outputLimit) {
+            postReceive(fd, connection);
+        }
+    }
+
+public:
+    // Takes ownership of a listening socket. Throws runtime_error, leaving the socket open for
+    // another backend, when io_uring is not available.
+    IoUringServer(Protocol& protocol, int listenFd) : ring(queueEntries), protocol(protocol), listenFd(listenFd) {
+        // Ring accepts wait for a client themselves; a non-blocking listener would fail them with EAGAIN.
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    IoUringServer(const IoUringServer&) = delete;
+    IoUringServer& operator=(const IoUringServer&) = delete;
+
+    // Shuts the sockets down first so no posted receive is left writing into a freed buffer.
+    ~IoUringServer() {
+        for (size_t fd = 0; fd < connections.size(); ++fd) {
+            if (connections[fd]) {
+                shutdown(static_cast<int>(fd), SHUT_RDWR);
+            }
+        }
+        shutdown(listenFd, SHUT_RDWR);
+        ring.submitAndWait(0);
+        ring.forEachCompletion([](const io_uring_cqe&) {});
+        for (size_t fd = 0; fd < connections.size(); ++fd) {
+            if (connections[fd]) {
+                close(static_cast<int>(fd));
+            }
+        }
+        close(listenFd);
+    }
+
+    uint64_t getAcceptedCount() const { return accepted; }
+    const uint64_t* getSyscallCounter() const { return &syscalls; }
+
+    // Serves clients until stop becomes true (checked at least every 100 ms).
+    void run(const atomic<bool>& stop) {
+        postAccept();
+        postTimeout();
+        while (!stop.load(memory_order_relaxed)) {
+            syscalls++;
+            if (ring.submitAndWait(1) < 0 && errno != EINTR) {
+                throw runtime_error(string("io_uring_enter: ") + strerror(errno));
+            }
+            ring.forEachCompletion([&](const io_uring_cqe& cqe) {
+                int fd = static_cast<int>(cqe.user_data >> 8);
+                switch (static_cast<Operation>(cqe.user_data & 0xFF)) {
+                case AcceptOperation:
+                    onAccept(cqe.res);
+                    break;
+                case TimeoutOperation:
+                    postTimeout();
+                    break;
+                case ReceiveOperation:
+                    onReceive(fd, *connections[fd], cqe.res);
+                    break;
+                case SendOperation:
+                    onSend(fd, *connections[fd], cqe.res);
+                    break;
+                }
+            });
+        }
+    }
+};
+#endif
+
+// A thread-per-core TCP server. Each reactor thread owns one shard of the keys (its own table and
+// CommandProcessor, touched by no other thread), its own epoll loop and its own SO_REUSEPORT
+// listener, so the kernel spreads connections across reactors. A request whose key belongs to
+// another shard is forwarded to that shard's reactor over a lock-free SpscQueue (one per ordered
+// pair of reactors) and the reply comes back the same way; an eventfd wakes a reactor blocked in
+// epoll_wait when messages arrive. MGET is split into one GET per key, and STATS is asked of every
+// shard and the counts added up; DUMP is refused, as its keys would span every shard. Replies are
+// buffered per connection and released strictly in request order, however the shards finish.
+class ShardedServer {
+private:
+    static constexpr size_t readChunk = 1 << 16;
+    static constexpr size_t queueCapacity = 1 << 14;
+    static constexpr size_t inputLimit = 1 << 22;    // Close a client whose unfinished line grows past this
+
+    struct Message {
+        int connection = -1;        // File descriptor of the connection at the origin reactor
+        uint32_t generation = 0;    // Tells a reused descriptor from the connection that sent the request
+        uint64_t sequence = 0;      // Request number within the connection
+        uint32_t part = 0;          // Key number within an MGET
+        bool response = false;
+        string text;                // A single-key command line, or its reply without the newline
+    };
+
+    struct PendingReply {
+        vector<string> parts;       // One reply per key; MGET joins them with spaces
+        int outstanding = 0;        // Parts still being computed by other shards
+        bool stats = false;         // Parts are the STATS replies of every shard, to be summed
+    };
+
+    struct Connection {
+        vector<char> input;
+        size_t filled = 0;
+        string output;
+        size_t written = 0;
+        uint32_t generation = 0;
+        uint32_t interest = 0;
+        uint64_t nextSequence = 0;  // Sequence number of the next request
+        deque<PendingReply> pending;
+        uint64_t firstPending = 0;  // Sequence number of pending.front()
+        bool dirty = false;         // Has output to attempt this pass
+    };
+
+    struct Reactor {
+        int index;
+        int listenFd = -1;
+        int epollFd = -1;
+        int wakeFd = -1;
+        HashTableLinearProbing<string, int> table;
+        CommandProcessor processor;
+        vector<unique_ptr<Connection>> connections;  // Indexed by file descriptor
+        vector<int> dirtyConnections;
+        vector<vector<Message>> outbox;              // Messages waiting for room in each target's queue
+        uint32_t nextGeneration = 1;
+        uint64_t forwarded = 0;
+        string reply;                                // Scratch for locally executed commands
+
+        Reactor(int index, int capacity) : index(index), table(capacity), processor(table) {}
+
+        ~Reactor() {
+            for (size_t fd = 0; fd < connections.size(); ++fd) {
+                if (connections[fd]) {
+                    close(static_cast<int>(fd));
+                }
+            }
+            for (int fd : { listenFd, epollFd, wakeFd }) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+    };
+
+    int reactorCount;
+    vector<unique_ptr<Reactor>> reactors;
+    vector<unique_ptr<SpscQueue<Message>>> queues;   // queues[from * reactorCount + to]
+
+    int shardOf(string_view key) const {
+        return static_cast<int>((static_cast<uint64_t>(static_cast<uint32_t>(mixHash(hash<string_view>()(key)))) * reactorCount) >> 32);
+    }
+
+    static string_view nextToken(string_view& rest) {
+        size_t start = rest.find_first_not_of(" \t");
+        if (start == string_view::npos) {
+            rest = string_view();
+            return string_view();
+        }
+        size_t stop = rest.find_first_of(" \t", start);
+        string_view token = rest.substr(start, stop == string_view::npos ? string_view::npos : stop - start);
+        rest = stop == string_view::npos ? string_view() : rest.substr(stop);
+        return token;
+    }
+
+    // Runs a single-key command line on this reactor's shard and returns the reply without its newline.
+    static string& execute(Reactor& reactor, string_view line) {
+        reactor.reply.clear();
+        reactor.processor.processLine(line, reactor.reply);
+        if (!reactor.reply.empty() && reactor.reply.back() == '\n') {
+            reactor.reply.pop_back();
+        }
+        return reactor.reply;
+    }
+
+    void markDirty(Reactor& reactor, int fd, Connection& connection) {
+        if (!connection.dirty) {
+            connection.dirty = true;
+            reactor.dirtyConnections.push_back(fd);
+        }
+    }
+
+    // Adds up the counters of every shard's STATS reply into one reply in the same format.
+    static string mergeStats(const vector<string>& parts) {
+        uint64_t commands = 0, keys = 0, calls = 0;
+        for (const string& part : parts) {
+            string_view rest = part;
+            for (string_view field = nextToken(rest); !field.empty(); field = nextToken(rest)) {
+                size_t equals = field.find('=');
+                uint64_t value = 0;
+                if (equals == string_view::npos || from_chars(field.data() + equals + 1, field.data() + field.size(), value).ec != errc()) {
+                    continue;
+                }
+                string_view name = field.substr(0, equals);
+                if (name == "commands") {
+                    commands += value;
+                }
+                else if (name == "keys") {
+                    keys += value;
+                }
+                else if (name == "syscalls") {
+                    calls += value;
+                }
+            }
+        }
+        return "STATS commands=" + to_string(commands) + " keys=" + to_string(keys) + " syscalls=" + to_string(calls)
+            + " syscalls_per_op=" + to_string(static_cast<double>(calls) / max<uint64_t>(commands, 1));
+    }
+
+    // Moves completed replies from the front of the pending queue to the output, in order.
+    void releaseReplies(Reactor& reactor, int fd, Connection& connection) {
+        while (!connection.pending.empty() && connection.pending.front().outstanding == 0) {
+            PendingReply& front = connection.pending.front();
+            if (front.stats) {
+                front.parts.assign(1, mergeStats(front.parts));
+            }
+            for (size_t part = 0; part < front.parts.size(); ++part) {
+                if (part > 0) {
+                    connection.output += ' ';
+                }
+                connection.output += front.parts[part];
+            }
+            connection.output += '\n';
+            connection.pending.pop_front();
+            connection.firstPending++;
+        }
+        markDirty(reactor, fd, connection);
+    }
+
+    // Answers one part of a request here or forwards it to the given shard.
+    void dispatch(Reactor& reactor, int fd, Connection& connection, PendingReply& pending, uint32_t part, int shard, string_view line) {
+        if (shard == reactor.index) {
+            pending.parts[part] = execute(reactor, line);
+            return;
+        }
+        Message message;
+        message.connection = fd;
+        message.generation = connection.generation;
+        message.sequence = connection.nextSequence;
+        message.part = part;
+        message.text.assign(line.data(), line.size());
+        reactor.outbox[shard].push_back(move(message));
+        pending.outstanding++;
+        reactor.forwarded++;
+    }
+
+    void handleLine(Reactor& reactor, int fd, Connection& connection, string_view line) {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        string_view rest = line;
+        string_view name = nextToken(rest);
+        if (name.empty()) {
+            return;
+        }
+        connection.pending.emplace_back();
+        PendingReply& pending = connection.pending.back();
+        if (name == "MGET") {
+            vector<string_view> keys;
+            for (string_view key = nextToken(rest); !key.empty(); key = nextToken(rest)) {
+                keys.push_back(key);
+            }
+            if (keys.empty()) {
+                pending.parts.push_back(execute(reactor, line));
+            }
+            else {
+                pending.parts.resize(keys.size());
+                string getLine;
+                for (uint32_t part = 0; part < keys.size(); ++part) {
+                    getLine = "GET ";
+                    getLine.append(keys[part].data(), keys[part].size());
+                    dispatch(reactor, fd, connection, pending, part, shardOf(keys[part]), getLine);
+                }
+            }
+        }
+        else if (name == "STATS") {
+            pending.parts.resize(reactorCount);
+            pending.stats = true;
+            for (int shard = 0; shard < reactorCount; ++shard) {
+                dispatch(reactor, fd, connection, pending, shard, shard, line);
+            }
+        }
+        else if (name == "DUMP") {
+            pending.parts.push_back("ERROR DUMP is not supported by the sharded server");
+        }
+        else {
+            // Single-key commands go to the key's shard; anything else (errors) runs here.
+            string_view key = nextToken(rest);
+            pending.parts.resize(1);
+            dispatch(reactor, fd, connection, pending, 0, key.empty() ? reactor.index : shardOf(key), line);
+        }
+        connection.nextSequence++;
+    }
+
+    void watch(Reactor& reactor, int fd, uint32_t events, int operation) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(reactor.epollFd, operation, fd, &event) < 0) {
+            throw runtime_error(string("epoll_ctl: ") + strerror(errno));
+        }
+    }
+
+    void closeConnection(Reactor& reactor, int fd) {
+        epoll_ctl(reactor.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        reactor.connections[fd].reset();   // Replies still in flight for it are dropped by generation.
+    }
+
+    void acceptConnections(Reactor& reactor) {
+        while (true) {
+            int fd = accept4(reactor.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            if (static_cast<size_t>(fd) >= reactor.connections.size()) {
+                reactor.connections.resize(fd + 1);
+            }
+            reactor.connections[fd] = make_unique<Connection>();
+            reactor.connections[fd]->generation = reactor.nextGeneration++;
+            reactor.connections[fd]->interest = EPOLLIN;
+            watch(reactor, fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    bool readFrom(Reactor& reactor, int fd, Connection& connection) {
+        if (connection.input.size() - connection.filled < readChunk) {
+            connection.input.resize(connection.filled + readChunk);
+        }
+        ssize_t received = read(fd, connection.input.data() + connection.filled, readChunk);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+            return false;
+        }
+        if (received < 0) {
+            return true;
+        }
+        connection.filled += received;
+        size_t consumed = 0;
+        while (const char* newline = static_cast<const char*>(memchr(connection.input.data() + consumed, '\n', connection.filled - consumed))) {
+            handleLine(reactor, fd, connection, string_view(connection.input.data() + consumed, newline - (connection.input.data() + consumed)));
+            consumed = newline - connection.input.data() + 1;
+        }
+        memmove(connection.input.data(), connection.input.data() + consumed, connection.filled - consumed);
+        connection.filled -= consumed;
+        releaseReplies(reactor, fd, connection);
+        return connection.filled < inputLimit;
+    }
+
+    bool writeTo(int fd, Connection& connection) {
+        while (connection.written < connection.output.size()) {
+            ssize_t sent = send(fd, connection.output.data() + connection.written,
+                connection.output.size() - connection.written, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN) {
+                    break;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            connection.written += sent;
+        }
+        if (connection.written == connection.output.size()) {
+            connection.output.clear();
+            connection.written = 0;
+        }
+        return true;
+    }
+
+    // Executes requests forwarded to this shard and delivers replies to this reactor's connections.
+    void drainInbound(Reactor& reactor) {
+        Message message;
+        for (int from = 0; from < reactorCount; ++from) {
+            if (from == reactor.index) {
+                continue;
+            }
+            SpscQueue<Message>& queue = *queues[from * reactorCount + reactor.index];
+            while (queue.pop(message)) {
+                if (!message.response) {
+                    message.text = execute(reactor, message.text);
+                    message.response = true;
+                    reactor.outbox[from].push_back(move(message));
+                    continue;
+                }
+                int fd = message.connection;
+                Connection* connection = reactor.connections[fd].get();
+                if (connection == nullptr || connection->generation != message.generation) {
+                    continue;
+                }
+                PendingReply& pending = connection->pending[message.sequence - connection->firstPending];
+                pending.parts[message.part] = move(message.text);
+                pending.outstanding--;
+                releaseReplies(reactor, fd, *connection);
+            }
+        }
+    }
+
+    // Pushes queued messages to the other reactors and wakes each one that received something.
+    // Returns whether anything is still waiting for queue space.
+    bool flushOutboxes(Reactor& reactor) {
+        bool waiting = false;
+        for (int to = 0; to < reactorCount; ++to) {
+            vector<Message>& outbox = reactor.outbox[to];
+            if (outbox.empty()) {
+                continue;
+            }
+            SpscQueue<Message>& queue = *queues[reactor.index * reactorCount + to];
+            size_t pushed = 0;
+            while (pushed < outbox.size() && queue.push(move(outbox[pushed]))) {
+                pushed++;
+            }
+            outbox.erase(outbox.begin(), outbox.begin() + pushed);
+            waiting |= !outbox.empty();
+            if (pushed > 0) {
+                uint64_t one = 1;
+                ssize_t ignored = write(reactors[to]->wakeFd, &one, sizeof(one));
+                (void)ignored;
+            }
+        }
+        return waiting;
+    }
+
+    void runReactor(Reactor& reactor, const atomic<bool>& stop) {
+        epoll_event events[256];
+        bool waiting = false;
+        while (!stop.load(memory_order_relaxed)) {
+            // Do not sleep while messages are waiting for queue space or may have just arrived.
+            int ready = epoll_wait(reactor.epollFd, events, 256, waiting ? 0 : 100);
+            for (int i = 0; i < ready; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == reactor.listenFd) {
+                    acceptConnections(reactor);
+                }
+                else if (fd == reactor.wakeFd) {
+                    uint64_t count;
+                    ssize_t ignored = read(reactor.wakeFd, &count, sizeof(count));
+                    (void)ignored;
+                }
+                else if (reactor.connections[fd] && !readFrom(reactor, fd, *reactor.connections[fd])) {
+                    closeConnection(reactor, fd);
+                }
+                else if (reactor.connections[fd]) {
+                    markDirty(reactor, fd, *reactor.connections[fd]);
+                }
+            }
+            drainInbound(reactor);
+            waiting = flushOutboxes(reactor);
+
+            for (int fd : reactor.dirtyConnections) {
+                Connection* connection = reactor.connections[fd].get();
+                if (connection == nullptr) {
+                    continue;
+                }
+                connection->dirty = false;
+                if (!writeTo(fd, *connection)) {
+                    closeConnection(reactor, fd);
+                    continue;
+                }
+                uint32_t interest = connection->written < connection->output.size() ? uint32_t(EPOLLIN | EPOLLOUT) : uint32_t(EPOLLIN);
+                if (interest != connection->interest) {
+                    watch(reactor, fd, interest, EPOLL_CTL_MOD);
+                    connection->interest = interest;
+                }
+            }
+            reactor.dirtyConnections.clear();
+        }
+    }
+
+public:
+    // Sets up reactorCount reactors listening on the same loopback port, with capacity slots split
+    // evenly between their shards.
+    ShardedServer(int reactorCount, int port, int capacity) : reactorCount(max(1, reactorCount)) {
+        int shardCapacity = capacity / this->reactorCount + 1;
+        for (int index = 0; index < this->reactorCount; ++index) {
+            auto reactor = make_unique<Reactor>(index, shardCapacity);
+            reactor->outbox.resize(this->reactorCount);
+            reactor->listenFd = openTcpListener(port, true);
+            reactor->epollFd = epoll_create1(EPOLL_CLOEXEC);
+            reactor->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (reactor->epollFd < 0 || reactor->wakeFd < 0) {
+                throw runtime_error(string("Cannot create reactor: ") + strerror(errno));
+            }
+            watch(*reactor, reactor->listenFd, EPOLLIN, EPOLL_CTL_ADD);
+            watch(*reactor, reactor->wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+            reactors.push_back(move(reactor));
+        }
+        for (int pair = 0; pair < this->reactorCount * this->reactorCount; ++pair) {
+            queues.push_back(make_unique<SpscQueue<Message>>(queueCapacity));
+        }
+    }
+
+    // Runs one thread per reactor, each pinned to its own core where possible, until stop is set.
+    void run(const atomic<bool>& stop) {
+        vector<thread> threads;
+        unsigned cores = max(1u, thread::hardware_concurrency());
+        for (auto& reactor : reactors) {
+            threads.emplace_back([this, &reactor, &stop]() { runReactor(*reactor, stop); });
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(reactor->index % cores, &cpus);
+            pthread_setaffinity_np(threads.back().native_handle(), sizeof(cpus), &cpus);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    int getReactorCount() const { return reactorCount; }
+
+    // Totals over all reactors; call after run() has returned.
+    uint64_t getOperationCount() const {
+        uint64_t total = 0;
+        for (auto& reactor : reactors) {
+            total += reactor->processor.getOperationCount();
+        }
+        return total;
+    }
+
+    uint64_t getForwardedCount() const {
+        uint64_t total = 0;
+        for (auto& reactor : reactors) {
+            total += reactor->forwarded;
+        }
+        return total;
+    }
+
+    int getSize() const {
+        int total = 0;
+        for (auto& reactor : reactors) {
+            total += reactor->table.getSize();
+        }
+        return total;
+    }
+};
+
+// A string-to-integer table in a POSIX shared memory segment, written by one process and read by
+// any number of others. The segment holds a header, a power-of-two array of slots and an arena
+// of key bytes, and everything refers to keys by offset rather than pointer, so each process can
+// map it at a different address. Readers map it read-only and use it at once, with no copy.
+// Consistency comes from a seqlock: the writer makes the header's sequence odd before changing
+// anything and even again afterwards, and a reader retries a lookup whose sequence was odd or
+// changed while it ran. Key bytes are only ever appended to the arena, so a key a reader saw
+// never changes under it.
+class SharedMemoryTable {
+private:
+    static constexpr uint32_t sharedMagic = 0x54485348;  // "HSHT"
+    enum SlotState : uint32_t { FreeSlot = 0, UsedSlot = 1, RemovedSlot = 2 };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t ready;                 // Set last, once the segment is initialised
+        uint64_t capacity;              // Slots; a power of two
+        uint64_t slotsOffset;           // Offsets from the start of the segment
+        uint64_t arenaOffset;
+        uint64_t arenaBytes;
+        alignas(64) atomic<uint64_t> sequence;  // Odd while the writer is changing the table
+        atomic<uint64_t> arenaUsed;
+        atomic<uint64_t> size;
+    };
+
+    struct Slot {
+        uint64_t hashValue;
+        uint64_t keyOffset;             // Into the arena
+        uint32_t keyLength;
+        uint32_t state;                 // A SlotState
+        int64_t value;
+    };
+
+    char* base = nullptr;
+    size_t mappedBytes = 0;
+    bool writable = false;
+
+    Header& header() const { return *reinterpret_cast<Header*>(base); }
+    Slot* slots() const { return reinterpret_cast<Slot*>(base + header().slotsOffset); }
+    const char* arena() const { return base + header().arenaOffset; }
+
+    static uint64_t hashKey(string_view key) {
+        return mixHash(hash<string_view>()(key));
+    }
+
+    // Fields a reader may see mid-write go through relaxed atomic accesses; the seqlock decides
+    // whether what was read can be trusted.
+    template<typename T>
+    static T loadField(const T& field) { return __atomic_load_n(&field, __ATOMIC_RELAXED); }
+    template<typename T>
+    static void storeField(T& field, T value) { __atomic_store_n(&field, value, __ATOMIC_RELAXED); }
+
+    // Returns the slot holding key, or the slot where it would be inserted, or -1 when the table is full.
+    long long probe(string_view key, uint64_t hashValue, bool forInsert) const {
+        uint64_t mask = header().capacity - 1;
+        long long reuse = -1;
+        for (uint64_t index = hashValue & mask, probes = 0; probes <= mask; index = (index + 1) & mask, ++probes) {
+            const Slot& slot = slots()[index];
+            uint32_t state = loadField(slot.state);
+            if (state == FreeSlot) {
+                return reuse >= 0 ? reuse : static_cast<long long>(index);
+            }
+            if (state == RemovedSlot) {
+                if (forInsert && reuse < 0) {
+                    reuse = static_cast<long long>(index);
+                }
+                continue;
+            }
+            uint32_t length = loadField(slot.keyLength);
+            uint64_t offset = loadField(slot.keyOffset);
+            if (loadField(slot.hashValue) == hashValue && length == key.size()
+                && offset + length <= header().arenaBytes && memcmp(arena() + offset, key.data(), length) == 0) {
+                return static_cast<long long>(index);
+            }
+        }
+        return reuse;
+    }
+
+    void beginWrite() {
+        header().sequence.fetch_add(1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+
+    void endWrite() {
+        header().sequence.fetch_add(1, memory_order_release);
+    }
+
+    void map(int fd, size_t bytes, bool forWriting) {
+        void* address = mmap(nullptr, bytes, forWriting ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        int error = errno;
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw runtime_error(string("mmap: ") + strerror(error));
+        }
+        base = static_cast<char*>(address);
+        mappedBytes = bytes;
+        writable = forWriting;
+    }
+
+    SharedMemoryTable() = default;
+
+public:
+    SharedMemoryTable(SharedMemoryTable&& other) noexcept
+        : base(exchange(other.base, nullptr)), mappedBytes(other.mappedBytes), writable(other.writable) {}
+
+    SharedMemoryTable& operator=(SharedMemoryTable&& other) noexcept {
+        swap(base, other.base);
+        swap(mappedBytes, other.mappedBytes);
+        swap(writable, other.writable);
+        return *this;
+    }
+
+    ~SharedMemoryTable() {
+        if (base != nullptr) {
+            munmap(base, mappedBytes);
+        }
+    }
+
+    // Creates (or replaces) the segment `name` with room for `capacity` keys at load 0.5 and
+    // arenaBytes of key bytes, mapped for writing.
+    static SharedMemoryTable create(const string& name, int capacity, size_t arenaBytes) {
+        uint64_t slotCount = static_cast<uint64_t>(nextPowerOfTwo(max(2, capacity * 2)));
+        uint64_t slotsOffset = (sizeof(Header) + 63) / 64 * 64;
+        uint64_t arenaOffset = slotsOffset + slotCount * sizeof(Slot);
+        size_t bytes = arenaOffset + arenaBytes;
+
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(bytes)) < 0) {
+            int error = errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw runtime_error("Cannot create shared memory " + name + ": " + strerror(error));
+        }
+        SharedMemoryTable table;
+        table.map(fd, bytes, true);   // ftruncate left every byte zero: all slots are free
+        Header& header = *new (table.base) Header{ sharedMagic, 0, slotCount, slotsOffset, arenaOffset, arenaBytes, {}, {}, {} };
+        header.sequence.store(0);
+        header.arenaUsed.store(0);
+        header.size.store(0);
+        __atomic_store_n(&header.ready, 1u, __ATOMIC_RELEASE);
+        return table;
+    }
+
+    // Maps an existing segment read-only.
+    static SharedMemoryTable attach(const string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) < 0) {
+            int error = errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw runtime_error("Cannot open shared memory " + name + ": " + strerror(error));
+        }
+        SharedMemoryTable table;
+        table.map(fd, static_cast<size_t>(status.st_size), false);
+        if (table.mappedBytes < sizeof(Header) || table.header().magic != sharedMagic
+            || __atomic_load_n(&table.header().ready, __ATOMIC_ACQUIRE) != 1) {
+            throw runtime_error("Not a shared hash table (or still being created): " + name);
+        }
+        return table;
+    }
+
+    static void remove(const string& name) {
+        shm_unlink(name.c_str());
+    }
+
+    // Writer only. Inserts a key or overwrites its value; throws overflow_error when the slots or
+    // the key arena are full.
+    void insert(string_view key, int64_t value) {
+        if (!writable) {
+            throw logic_error("Shared table is mapped read-only");
+        }
+        uint64_t hashValue = hashKey(key);
+        long long index = probe(key, hashValue, true);
+        if (index < 0) {
+            throw overflow_error("Hash table is full");
+        }
+        Slot& slot = slots()[index];
+        if (slot.state == UsedSlot) {
+            beginWrite();
+            storeField(slot.value, value);
+            endWrite();
+            return;
+        }
+        uint64_t offset = header().arenaUsed.load(memory_order_relaxed);
+        if (offset + key.size() > header().arenaBytes) {
+            throw overflow_error("Key arena is full");
+        }
+        memcpy(base + header().arenaOffset + offset, key.data(), key.size());  // Not visible to readers yet.
+        beginWrite();
+        storeField(slot.hashValue, hashValue);
+        storeField(slot.keyOffset, offset);
+        storeField(slot.keyLength, static_cast<uint32_t>(key.size()));
+        storeField(slot.value, value);
+        storeField(slot.state, static_cast<uint32_t>(UsedSlot));
+        header().arenaUsed.store(offset + key.size(), memory_order_relaxed);
+        header().size.fetch_add(1, memory_order_relaxed);
+        endWrite();
+    }
+
+    // Writer only. The key's bytes stay in the arena; the slot becomes a tombstone.
+    bool erase(string_view key) {
+        if (!writable) {
+            throw logic_error("Shared table is mapped read-only");
+        }
+        long long index = probe(key, hashKey(key), false);
+        if (index < 0 || slots()[index].state != UsedSlot) {
+            return false;
+        }
+        beginWrite();
+        storeField(slots()[index].state, static_cast<uint32_t>(RemovedSlot));
+        header().size.fetch_sub(1, memory_order_relaxed);
+        endWrite();
+        return true;
+    }
+
+    // Looks a key up; safe in any process while the writer runs. retries, if given, counts the
+    // attempts that overlapped a write and were repeated.
+    bool find(string_view key, int64_t& value, uint64_t* retries = nullptr) const {
+        uint64_t hashValue = hashKey(key);
+        while (true) {
+            uint64_t before = header().sequence.load(memory_order_acquire);
+            if ((before & 1) == 0) {
+                long long index = probe(key, hashValue, false);
+                bool found = index >= 0 && loadField(slots()[index].state) == UsedSlot;
+                int64_t candidate = found ? loadField(slots()[index].value) : 0;
+                atomic_thread_fence(memory_order_acquire);
+                if (header().sequence.load(memory_order_relaxed) == before) {
+                    value = candidate;
+                    return found;
+                }
+            }
+            if (retries != nullptr) {
+                (*retries)++;
+            }
+            this_thread::yield();
+        }
+    }
+
+    uint64_t getSize() const { return header().size.load(memory_order_relaxed); }
+    uint64_t getCapacity() const { return header().capacity; }
+    uint64_t getArenaUsed() const { return header().arenaUsed.load(memory_order_relaxed); }
+    size_t getMappedBytes() const { return mappedBytes; }
+};
+
+// Drives a server from several client threads. Each connection sends batches of `pipeline`
+// requests (GETs, and putPercent% PUTs, over keySpace keys) and waits for all their replies before sending
+// the next batch; throughput counts requests, latency is the round trip of a batch.
+struct LoadReport {
+    int connections = 0;
+    int pipeline = 0;
+    double opsPerSecond = 0;
+    double p50 = 0, p99 = 0, p999 = 0, worst = 0;  // Batch round trips in microseconds
+    int failures = 0;                               // Clients that stopped on an error
+
+    void print(ostream& out) const {
+        out << connections << " connections, pipeline " << pipeline << ": " << opsPerSecond << " ops/sec"
+            << ", batch latency p50 " << p50 << " us, p99 " << p99 << " us, p99.9 " << p999
+            << " us, max " << worst << " us";
+        if (failures > 0) {
+            out << " (" << failures << " clients failed)";
+        }
+        out << "\n";
+    }
+};
+
+inline LoadReport runLoadGenerator(function<int()> connectClient, int connections, int requestsPerConnection, int pipeline, int keySpace, int putPercent = 10) {
+    vector<vector<double>> latencies(connections);
+    vector<thread> clients;
+    atomic<int> failures(0);
+    auto start = high_resolution_clock::now();
+    for (int c = 0; c < connections; ++c) {
+        clients.emplace_back([&, c]() {
+            try {
+                int fd = connectClient();
+                mt19937 rng(c + 1);
+                string batch;
+                vector<char> replies(1 << 16);
+                for (int sent = 0; sent < requestsPerConnection; sent += pipeline) {
+                    int count = min(pipeline, requestsPerConnection - sent);
+                    batch.clear();
+                    for (int i = 0; i < count; ++i) {
+                        int key = static_cast<int>(rng() % keySpace);
+                        if (static_cast<int>(rng() % 100) < putPercent) {
+                            batch += "PUT key" + to_string(key) + " " + to_string(sent + i) + "\n";
+                        }
+                        else {
+                            batch += "GET key" + to_string(key) + "\n";
+                        }
+                    }
+                    auto batchStart = high_resolution_clock::now();
+                    for (size_t offset = 0; offset < batch.size();) {
+                        ssize_t written = send(fd, batch.data() + offset, batch.size() - offset, MSG_NOSIGNAL);
+                        if (written <= 0) {
+                            throw runtime_error("Connection closed while sending");
+                        }
+                        offset += written;
+                    }
+                    for (int lines = 0; lines < count;) {
+                        ssize_t received = recv(fd, replies.data(), replies.size(), 0);
+                        if (received <= 0) {
+                            throw runtime_error("Connection closed while receiving");
+                        }
+                        lines += static_cast<int>(std::count(replies.data(), replies.data() + received, '\n'));
+                    }
+                    latencies[c].push_back(duration<double, micro>(high_resolution_clock::now() - batchStart).count());
+                }
+                close(fd);
+            }
+            catch (const exception& e) {
+                cerr << "Client " << c << ": " << e.what() << endl;
+                failures++;
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+
+    LoadReport report;
+    report.connections = connections;
+    report.pipeline = pipeline;
+    report.failures = failures;
+    vector<double> all;
+    for (auto& perClient : latencies) {
+        all.insert(all.end(), perClient.begin(), perClient.end());
+    }
+    if (all.empty()) {
+        return report;
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    report.opsPerSecond = static_cast<double>(all.size()) * pipeline / seconds;
+    report.p50 = percentile(0.5);
+    report.p99 = percentile(0.99);
+    report.p999 = percentile(0.999);
+    report.worst = all.back();
+    return report;
+}
+
+// Sends one command on a fresh connection and returns its reply line, e.g. for STATS.
+inline string queryServer(int fd, const string& command) {
+    string request = command + "\n";
+    string reply;
+    char buffer[512];
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size())) {
+        ssize_t received;
+        while (reply.find('\n') == string::npos && (received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            reply.append(buffer, received);
+        }
+    }
+    close(fd);
+    return reply.substr(0, reply.find('\n'));
+}
+
+template<typename Server, typename Protocol>
+uint64_t serveUntilStopped(Server& server, Protocol& processor, const atomic<bool>& stop) {
+    processor.attachSyscallCounter(server.getSyscallCounter());
+    server.run(stop);
+    processor.attachSyscallCounter(nullptr);
+    return server.getAcceptedCount();
+}
+
+// Serves processor on listenFd with the named backend, "epoll" or "io_uring", until stop is set,
+// falling back to epoll when io_uring cannot be set up. Returns the number of connections accepted.
+template<typename Protocol>
+uint64_t serveWithBackend(const string& backend, Protocol& processor, int listenFd, const atomic<bool>& stop) {
+#if HASH_TABLE_HAS_IO_URING
+    if (backend == "io_uring") {
+        unique_ptr<IoUringServer<Protocol>> server;
+        try {
+            server = make_unique<IoUringServer<Protocol>>(processor, listenFd);
+        }
+        catch (const runtime_error& e) {
+            cerr << "io_uring is not available (" << e.what() << "); using epoll.\n";
+        }
+        if (server) {
+            return serveUntilStopped(*server, processor, stop);
+        }
+    }
+#else
+    if (backend == "io_uring") {
+        cerr << "Built without io_uring support; using epoll.\n";
+    }
+#endif
+    EpollServer<Protocol> server(processor, listenFd);
+    return serveUntilStopped(server, processor, stop);
+}
+
+// Runs --serve: a CommandProcessor over one table behind the chosen backend, until SIGINT or SIGTERM.
+inline int runServerMode(const DriverOptions& options) {
+    HashTableLinearProbing<string, int> table(options.capacity);
+    CommandProcessor processor(table);
+    signal(SIGINT, [](int) { serverStopRequested = true; });
+    signal(SIGTERM, [](int) { serverStopRequested = true; });
+    int listenFd = openUnixListener(options.socketPath);
+    cout << "Serving on " << options.socketPath << " with " << options.backend << " (Ctrl+C to stop)" << endl;
+    uint64_t accepted = serveWithBackend(options.backend, processor, listenFd, serverStopRequested);
+    unlink(options.socketPath.c_str());
+    cout << "Served " << processor.getOperationCount() << " commands over " << accepted
+         << " connections; " << table.getSize() << " keys in the table\n";
+    return 0;
+}
+
+// Runs --memcached: a MemcachedProcessor behind the chosen backend on a loopback TCP port (when
+// the argument is a number) or a Unix domain socket, until SIGINT or SIGTERM.
+inline int runMemcachedMode(const DriverOptions& options) {
+    HashTableLinearProbing<string, CacheItem> table(options.capacity);
+    size_t maxItems = options.maxItems > 0 ? options.maxItems : static_cast<size_t>(options.capacity * 0.8);
+    MemcachedProcessor processor(table, maxItems, static_cast<size_t>(options.memoryMegabytes) << 20);
+    signal(SIGINT, [](int) { serverStopRequested = true; });
+    signal(SIGTERM, [](int) { serverStopRequested = true; });
+    bool tcp = options.socketPath.find_first_not_of("0123456789") == string::npos;
+    int listenFd = tcp ? openTcpListener(stoi(options.socketPath)) : openUnixListener(options.socketPath);
+    cout << "memcached protocol on " << (tcp ? "127.0.0.1:" : "") << options.socketPath << " with "
+         << options.backend << ", " << maxItems << " items or " << options.memoryMegabytes << " MB (Ctrl+C to stop)" << endl;
+    uint64_t accepted = serveWithBackend(options.backend, processor, listenFd, serverStopRequested);
+    if (!tcp) {
+        unlink(options.socketPath.c_str());
+    }
+    cout << "Served " << processor.getOperationCount() << " commands over " << accepted << " connections; "
+         << table.getSize() << " items, " << processor.getEvictionCount() << " evictions\n";
+    return 0;
+}
+
+// Runs --memcached-check: serves a MemcachedProcessor with a 1 MB limit on each backend in this
+// process, sends it requests a client must not be able to break it with, and checks the replies
+// and that the server still answers afterwards. Returns 1 if any check fails.
+inline int runMemcachedCheck(const DriverOptions& options) {
+    string path = "/tmp/hashtable-memcached-" + to_string(getpid()) + ".sock";
+    int failures = 0;
+    for (string backend : { "epoll", "io_uring" }) {
+        HashTableLinearProbing<string, CacheItem> table(options.capacity);
+        MemcachedProcessor processor(table, static_cast<size_t>(options.capacity * 0.8), 1 << 20);
+        atomic<bool> stop(false);
+        int listenFd = openUnixListener(path);
+        thread server([&]() { serveWithBackend(backend, processor, listenFd, stop); });
+
+        // Sends request on a fresh connection and compares the first replyLines lines it gets back.
+        auto check = [&](const string& name, const string& request, int replyLines, const string& expected) {
+            int fd = connectUnixSocket(path);
+            string reply;
+            char buffer[4096];
+            bool sent = send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size());
+            ssize_t received;
+            while (sent && count(reply.begin(), reply.end(), '\n') < replyLines && (received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                reply.append(buffer, received);
+            }
+            close(fd);
+            bool passed = reply == expected;
+            cout << backend << ", " << name << ": " << (passed ? "ok" : "FAILED") << "\n";
+            failures += !passed;
+        };
+        check("length that wraps around", "set k 0 0 18446744073709551614\r\n", 1, "SERVER_ERROR object too large for cache\r\n");
+        check("still serving", "set k 0 0 1\r\nv\r\nget k\r\n", 4, "STORED\r\nVALUE k 0 1\r\nv\r\nEND\r\n");
+        check("block larger than the cache", "set big 0 0 2000000\r\n" + string(2000000, 'x') + "\r\nget big\r\n", 2,
+              "SERVER_ERROR object too large for cache\r\nEND\r\n");
+        check("items kept", "get k\r\n", 3, "VALUE k 0 1\r\nv\r\nEND\r\n");
+
+        stop = true;
+        server.join();
+        unlink(path.c_str());
+    }
+    cout << (failures == 0 ? "All checks passed\n" : to_string(failures) + " checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
+
+// Runs --sharded: a ShardedServer with --reactors reactors on a loopback port, until SIGINT or SIGTERM.
+inline int runShardedMode(const DriverOptions& options) {
+    signal(SIGINT, [](int) { serverStopRequested = true; });
+    signal(SIGTERM, [](int) { serverStopRequested = true; });
+    ShardedServer server(options.reactors, options.port, options.capacity);
+    cout << "Serving on 127.0.0.1:" << options.port << " with " << server.getReactorCount() << " reactors (Ctrl+C to stop)" << endl;
+    server.run(serverStopRequested);
+    cout << "Served " << server.getOperationCount() << " commands, " << server.getForwardedCount()
+         << " forwarded between shards; " << server.getSize() << " keys in the tables\n";
+    return 0;
+}
+
+// Runs --scaling-report: the load generator against in-process sharded servers with 1, 2, 4, ...
+// reactors up to --reactors (the number of cores by default), with four connections per reactor.
+inline int runScalingReport(const DriverOptions& options) {
+    int cores = options.reactors;
+    double baseline = 0;
+    cout << "Sharded server scaling (" << thread::hardware_concurrency() << " cores available; the load generator shares them)\n";
+    for (int reactors = 1; ; reactors = min(reactors * 2, cores)) {
+        atomic<bool> stop(false);
+        ShardedServer server(reactors, options.port, options.capacity);
+        thread serverThread([&]() { server.run(stop); });
+        int port = options.port;
+        LoadReport report = runLoadGenerator([port]() { return connectTcpSocket(port); },
+            reactors * 4, options.requests, options.pipeline, options.keySpace);
+        stop = true;
+        serverThread.join();
+        if (baseline == 0) {
+            baseline = report.opsPerSecond;
+        }
+        cout << reactors << " reactors: ";
+        report.print(cout);
+        cout << "  speedup " << report.opsPerSecond / baseline << "x, "
+             << 100.0 * server.getForwardedCount() / max<uint64_t>(1, server.getOperationCount()) << "% of requests forwarded\n";
+        if (reactors == cores) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// Runs --shm-writer: creates the shared segment, loads it from --load (lines of "key value") or
+// with --keys synthetic keys key0, key1, ... and then keeps rewriting random values, so readers
+// see a live writer, until SIGINT or SIGTERM removes the segment.
+inline int runSharedWriterMode(const DriverOptions& options) {
+    signal(SIGINT, [](int) { serverStopRequested = true; });
+    signal(SIGTERM, [](int) { serverStopRequested = true; });
+    int keys = options.loadFile.empty() ? options.keySpace : options.capacity;
+    SharedMemoryTable table = SharedMemoryTable::create(options.sharedName, keys, static_cast<size_t>(keys) * 32 + (1 << 20));
+
+    auto start = high_resolution_clock::now();
+    vector<string> written;
+    if (!options.loadFile.empty()) {
+        ifstream in(options.loadFile);
+        string key;
+        int64_t value;
+        while (in >> key >> value) {
+            table.insert(key, value);
+            written.push_back(key);
+        }
+    }
+    else {
+        for (int i = 0; i < keys; ++i) {
+            written.push_back("key" + to_string(i));
+            table.insert(written.back(), i);
+        }
+    }
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+    cout << "Loaded " << table.getSize() << " keys into " << options.sharedName << " in " << seconds << " s ("
+         << table.getMappedBytes() / (1 << 20) << " MB shared); updating values until Ctrl+C" << endl;
+
+    mt19937 rng(42);
+    uint64_t updates = 0;
+    while (!serverStopRequested && !written.empty()) {
+        for (int i = 0; i < 1000; ++i) {
+            table.insert(written[rng() % written.size()], static_cast<int64_t>(rng()));
+        }
+        updates += 1000;
+        this_thread::sleep_for(milliseconds(1));
+    }
+    SharedMemoryTable::remove(options.sharedName);
+    cout << "Made " << updates << " updates; removed " << options.sharedName << "\n";
+    return 0;
+}
+
+// Runs --shm-reader: attaches to a writer's segment and times --requests random lookups of the
+// synthetic keys (about a tenth of them missing).
+inline int runSharedReaderMode(const DriverOptions& options) {
+    auto start = high_resolution_clock::now();
+    SharedMemoryTable table = SharedMemoryTable::attach(options.sharedName);
+    double attachMicros = duration<double, micro>(high_resolution_clock::now() - start).count();
+    int keySpace = static_cast<int>(max<uint64_t>(1, table.getSize()));
+
+    mt19937 rng(static_cast<unsigned>(getpid()));
+    vector<string> keys(options.requests);
+    for (auto& key : keys) {
+        key = "key" + to_string(rng() % (keySpace + keySpace / 10 + 1));
+    }
+    uint64_t hits = 0, retries = 0;
+    int64_t sum = 0, value;
+    start = high_resolution_clock::now();
+    for (const string& key : keys) {
+        if (table.find(key, value, &retries)) {
+            hits++;
+            sum += value;
+        }
+    }
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+    cout << "Attached to " << options.sharedName << " (" << table.getSize() << " keys) in " << attachMicros << " us; "
+         << keys.size() / seconds << " lookups/sec, " << hits << " hits, " << retries
+         << " seqlock retries (checksum " << sum << ")\n";
+    return 0;
+}
+
+// One node of a --cluster: a CommandProcessor behind an epoll loop on a Unix socket, run in a
+// forked child until SIGTERM.
+inline int runClusterNode(const string& path, int capacity) {
+    serverStopRequested = false;
+    signal(SIGTERM, [](int) { serverStopRequested = true; });
+    signal(SIGINT, SIG_IGN);   // Ctrl+C goes to the harness, which stops the nodes itself
+    HashTableLinearProbing<string, int> table(capacity);
+    CommandProcessor processor(table);
+    EpollServer<CommandProcessor> server(processor, openUnixListener(path));
+    server.run(serverStopRequested);
+    unlink(path.c_str());
+    return 0;
+}
+
+// Routes commands to the nodes of a cluster by jump consistent hash of the key. Each node is a
+// process serving CommandProcessor's protocol on a Unix socket. Batches are pipelined: every
+// node's share of a batch is sent in one write before any replies are read, and the replies are
+// put back in the order of the batch.
+class ClusterRouter {
+private:
+    vector<int> sockets;
+    vector<string> requests;                // Per node, while a batch is being sent
+    vector<vector<size_t>> positions;       // Per node, the batch positions of its requests
+    vector<char> buffer = vector<char>(1 << 16);
+
+    static void sendAll(int fd, const string& data) {
+        for (size_t offset = 0; offset < data.size();) {
+            ssize_t sent = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                throw runtime_error("Cluster node closed the connection");
+            }
+            offset += sent;
+        }
+    }
+
+    // Sends a block of `count` commands to a node, waits for all their replies and returns how
+    // many of them were not OK.
+    size_t pipelineAndWait(int node, const string& block, size_t count) {
+        if (count == 0) {
+            return 0;
+        }
+        sendAll(sockets[node], block);
+        string pending;
+        size_t replies = 0, failed = 0;
+        readLines(sockets[node], pending, [&](string_view line) {
+            failed += line != "OK";
+            return ++replies == count;
+        });
+        return failed;
+    }
+
+    // Reads reply lines from a node until stop(line) returns true for one of them.
+    template<typename Function>
+    void readLines(int fd, string& pending, Function&& stop) {
+        while (true) {
+            size_t start = 0;
+            for (size_t newline; (newline = pending.find('\n', start)) != string::npos; start = newline + 1) {
+                if (stop(string_view(pending).substr(start, newline - start))) {
+                    pending.erase(0, newline + 1);
+                    return;
+                }
+            }
+            pending.erase(0, start);
+            ssize_t received = recv(fd, buffer.data(), buffer.size(), 0);
+            if (received <= 0) {
+                throw runtime_error("Cluster node closed the connection");
+            }
+            pending.append(buffer.data(), received);
+        }
+    }
+
+public:
+    // Connects to every node, retrying for a while so freshly started nodes have time to listen.
+    explicit ClusterRouter(const vector<string>& nodePaths) {
+        for (const string& path : nodePaths) {
+            addNode(path);
+        }
+    }
+
+    ClusterRouter(const ClusterRouter&) = delete;
+    ClusterRouter& operator=(const ClusterRouter&) = delete;
+
+    ~ClusterRouter() {
+        for (int fd : sockets) {
+            close(fd);
+        }
+    }
+
+    void addNode(const string& path) {
+        for (int attempt = 0; ; ++attempt) {
+            try {
+                sockets.push_back(connectUnixSocket(path));
+                break;
+            }
+            catch (const runtime_error&) {
+                if (attempt == 200) {
+                    throw;
+                }
+                this_thread::sleep_for(milliseconds(10));
+            }
+        }
+        requests.resize(sockets.size());
+        positions.resize(sockets.size());
+    }
+
+    int getNodeCount() const { return static_cast<int>(sockets.size()); }
+
+    static int nodeFor(string_view key, int nodes) {
+        return jumpConsistentHash(hash<string_view>()(key), nodes);
+    }
+
+    // Executes command lines whose second token is the key and returns their replies in order.
+    vector<string> execute(const vector<string>& lines) {
+        for (size_t i = 0; i < lines.size(); ++i) {
+            size_t start = lines[i].find(' ') + 1;
+            string_view key = string_view(lines[i]).substr(start, lines[i].find(' ', start) - start);
+            int node = nodeFor(key, getNodeCount());
+            requests[node] += lines[i];
+            requests[node] += '\n';
+            positions[node].push_back(i);
+        }
+        for (int node = 0; node < getNodeCount(); ++node) {
+            if (!requests[node].empty()) {
+                sendAll(sockets[node], requests[node]);
+                requests[node].clear();
+            }
+        }
+        vector<string> replies(lines.size());
+        string pending;
+        for (int node = 0; node < getNodeCount(); ++node) {
+            size_t next = 0;
+            if (!positions[node].empty()) {
+                readLines(sockets[node], pending, [&](string_view line) {
+                    replies[positions[node][next++]] = string(line);
+                    return next == positions[node].size();
+                });
+            }
+            positions[node].clear();
+        }
+        return replies;
+    }
+
+    // Sends one command to one node and returns its single-line reply.
+    string command(int node, const string& line) {
+        sendAll(sockets[node], line + "\n");
+        string pending, reply;
+        readLines(sockets[node], pending, [&](string_view received) {
+            reply = string(received);
+            return true;
+        });
+        return reply;
+    }
+
+    // Moves to `target` every key of the other nodes that jump hash places there once the cluster
+    // has target + 1 nodes; only those keys move, found by the nodes themselves with a filtered
+    // DUMP. Returns the number of keys moved and adds the bytes sent and received to transferred.
+    size_t rebalanceTo(int target, size_t& transferred) {
+        size_t moved = 0;
+        string dumpCommand = "DUMP " + to_string(target + 1) + " " + to_string(target) + "\n";
+        for (int node = 0; node < target; ++node) {
+            sendAll(sockets[node], dumpCommand);
+            string puts, deletes, pending;
+            size_t keys = 0;
+            readLines(sockets[node], pending, [&](string_view line) {
+                transferred += line.size() + 1;
+                if (line == "END") {
+                    return true;
+                }
+                puts += "PUT ";
+                puts.append(line.data(), line.size());
+                puts += '\n';
+                deletes += "DEL ";
+                deletes.append(line.data(), line.find(' '));
+                deletes += '\n';
+                keys++;
+                return false;
+            });
+            // Copy before deleting, so a key is never missing from both nodes.
+            if (pipelineAndWait(target, puts, keys) > 0) {
+                throw runtime_error("Node " + to_string(target) + " rejected keys moved to it; is it full?");
+            }
+            pipelineAndWait(node, deletes, keys);
+            transferred += puts.size() + deletes.size();
+            moved += keys;
+        }
+        return moved;
+    }
+};
+
+// Runs --cluster N: forks N node processes, loads --keys keys through a ClusterRouter and measures
+// aggregate throughput with --connections client threads (each with its own router). Then it
+// starts one more node, rebalances, checks every key is still found, and measures again.
+// Each node gets --capacity slots, or twice its share of the keys if that is more. The run fails
+// if any PUT is refused.
+inline int runClusterMode(const DriverOptions& options) {
+    string prefix = "/tmp/hashtable-cluster-" + to_string(getpid()) + "-";
+    int nodeCapacity = static_cast<int>(max<long long>(options.capacity, 2LL * options.keySpace / max(1, options.clusterNodes)));
+    atomic<size_t> rejected(0);
+    // Counts the replies to the PUTs of a batch that were not OK.
+    auto countRejected = [&](const vector<string>& batch, const vector<string>& replies) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (batch[i].compare(0, 4, "PUT ") == 0 && replies[i] != "OK") {
+                rejected++;
+            }
+        }
+    };
+    vector<pid_t> children;
+    vector<string> paths;
+    auto startNode = [&]() {
+        string path = prefix + to_string(paths.size()) + ".sock";
+        cout.flush();   // The child must not inherit and repeat buffered output.
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(runClusterNode(path, nodeCapacity));
+        }
+        if (pid < 0) {
+            throw runtime_error(string("fork: ") + strerror(errno));
+        }
+        children.push_back(pid);
+        paths.push_back(path);
+    };
+    auto stopNodes = [&]() {
+        for (pid_t pid : children) {
+            kill(pid, SIGTERM);
+        }
+        for (pid_t pid : children) {
+            waitpid(pid, nullptr, 0);
+        }
+    };
+    auto measureThroughput = [&]() {
+        vector<thread> clients;
+        atomic<int> failures(0);
+        auto start = high_resolution_clock::now();
+        for (int c = 0; c < options.connections; ++c) {
+            clients.emplace_back([&, c]() {
+                try {
+                    ClusterRouter router(paths);
+                    mt19937 rng(c + 1);
+                    vector<string> batch;
+                    for (int done = 0; done < options.requests; done += options.pipeline) {
+                        batch.clear();
+                        for (int i = 0; i < options.pipeline; ++i) {
+                            int key = static_cast<int>(rng() % options.keySpace);
+                            batch.push_back(rng() % 10 == 0 ? "PUT key" + to_string(key) + " " + to_string(key)
+                                                            : "GET key" + to_string(key));
+                        }
+                        countRejected(batch, router.execute(batch));
+                    }
+                }
+                catch (const exception& e) {
+                    cerr << "Client " << c << ": " << e.what() << endl;
+                    failures++;
+                }
+            });
+        }
+        for (auto& client : clients) {
+            client.join();
+        }
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        cout << paths.size() << " nodes: " << static_cast<double>(options.connections) * options.requests / seconds
+             << " ops/sec with " << options.connections << " clients, batches of " << options.pipeline;
+        if (failures > 0) {
+            cout << " (" << failures << " clients failed)";
+        }
+        cout << "\n";
+    };
+
+    try {
+        for (int node = 0; node < options.clusterNodes; ++node) {
+            startNode();
+        }
+        ClusterRouter router(paths);
+        auto start = high_resolution_clock::now();
+        vector<string> batch;
+        for (int key = 0; key < options.keySpace; ++key) {
+            batch.push_back("PUT key" + to_string(key) + " " + to_string(key));
+            if (batch.size() == 1024 || key + 1 == options.keySpace) {
+                countRejected(batch, router.execute(batch));
+                batch.clear();
+            }
+        }
+        if (rejected > 0) {
+            throw runtime_error(to_string(rejected) + " of " + to_string(options.keySpace) + " keys were refused while loading");
+        }
+        cout << "Loaded " << options.keySpace << " keys into " << paths.size() << " nodes in "
+             << duration<double>(high_resolution_clock::now() - start).count() << " s\n";
+        measureThroughput();
+
+        startNode();
+        router.addNode(paths.back());
+        size_t transferred = 0;
+        start = high_resolution_clock::now();
+        size_t moved = router.rebalanceTo(router.getNodeCount() - 1, transferred);
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        cout << "Added node " << paths.size() << ": moved " << moved << " keys ("
+             << 100.0 * moved / options.keySpace << "%, ideal " << 100.0 / paths.size() << "%) in " << seconds
+             << " s, " << transferred / 1024 << " KiB over the sockets\n";
+
+        size_t missing = 0;
+        for (int key = 0; key < options.keySpace; ++key) {
+            batch.push_back("GET key" + to_string(key));
+            if (batch.size() == 1024 || key + 1 == options.keySpace) {
+                for (const string& reply : router.execute(batch)) {
+                    missing += reply == "NIL";
+                }
+                batch.clear();
+            }
+        }
+        cout << "After rebalancing " << missing << " keys are missing\n";
+        measureThroughput();
+    }
+    catch (...) {
+        stopNodes();
+        throw;
+    }
+    stopNodes();
+    if (rejected > 0) {
+        cerr << rejected << " PUTs were refused by the nodes\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Serialises a protocol with other users of its table, such as a replica's apply thread.
+template<typename Protocol>
+class LockedProtocol {
+private:
+    Protocol& inner;
+    mutex& guard;
+
+public:
+    LockedProtocol(Protocol& inner, mutex& guard) : inner(inner), guard(guard) {}
+
+    size_t processBuffer(const char* data, size_t length, string& out) {
+        lock_guard<mutex> hold(guard);
+        return inner.processBuffer(data, length, out);
+    }
+
+    void attachSyscallCounter(const uint64_t* counter) { inner.attachSyscallCounter(counter); }
+};
+
+// The replication stream. The primary sends frames of
+//     uint8 type, uint64 sequence, uint32 payload length, payload
+// where a SnapshotFrame carries a table snapshot (the initial sync) and a ChangesFrame a batch of
+// change records, both in the snapshot encoding; sequence is the last change the frame covers.
+// The replica answers every frame with 16 bytes: the sequence it has applied and, for a
+// ChecksumFrame, the checksum of its table (0 otherwise).
+enum ReplicationFrame : uint8_t { SnapshotFrame = 1, ChangesFrame = 2, ChecksumFrame = 3 };
+
+// An order-independent checksum of a table's contents, for checking replicas against the primary.
+inline uint64_t tableChecksum(const HashTableLinearProbing<string, int>& table) {
+    uint64_t checksum = 0;
+    table.for_each([&](const string& key, const int& value) {
+        checksum += mixHash(hash<string>()(key) ^ static_cast<uint32_t>(value));
+    });
+    return checksum;
+}
+
+inline void readExact(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(fd, data, length, 0);
+        if (received <= 0) {
+            throw runtime_error("Replication stream closed");
+        }
+        data += received;
+        length -= received;
+    }
+}
+
+inline void sendExact(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            throw runtime_error("Replication stream closed");
+        }
+        data += sent;
+        length -= sent;
+    }
+}
+
+// The primary side: applies inserts and removals to its table and logs them as change records.
+// flush() sends the records logged since the last flush to every replica as one frame. Replicas
+// that connect get a snapshot first and then every later batch. Acknowledgements are collected
+// without blocking and give the lag metrics: how many changes each replica is behind and how long
+// a batch took from being sent to being acknowledged. A replica only counts towards them once it
+// has loaded its snapshot; the time that takes is reported separately as its catch-up time.
+class ReplicationPrimary {
+private:
+    struct Replica {
+        int fd = -1;
+        uint64_t acknowledged = 0;  // Last sequence the replica reported applied
+        uint64_t checksum = 0;      // From the latest ChecksumFrame acknowledgement
+        uint64_t framesSent = 0;
+        uint64_t framesAnswered = 0;  // Each frame gets exactly one acknowledgement, in order
+        string received;            // Partial acknowledgement bytes
+    };
+
+    HashTableLinearProbing<string, int>& table;
+    int listenFd;
+    vector<Replica> replicas;
+    uint64_t sequence = 0;
+    ostringstream batch;            // Records logged since the last flush
+    size_t batchRecords = 0;
+    deque<pair<uint64_t, high_resolution_clock::time_point>> inFlight;  // Last sequence and send time of each unacknowledged batch
+    vector<double> ackMicros;       // Send-to-acknowledgement time of every batch, slowest replica
+    vector<double> catchUpMicros;   // Snapshot send-to-acknowledgement time of every replica
+    uint64_t maxLag = 0;            // Most changes any replica was behind at a flush
+
+    void sendFrame(Replica& replica, ReplicationFrame type, const string& payload) {
+        string frame;
+        frame.push_back(static_cast<char>(type));
+        frame.append(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+        uint32_t length = static_cast<uint32_t>(payload.size());
+        frame.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        frame += payload;
+        sendExact(replica.fd, frame.data(), frame.size());
+        replica.framesSent++;
+    }
+
+    uint64_t slowestAcknowledged() const {
+        uint64_t slowest = sequence;
+        for (const auto& replica : replicas) {
+            slowest = min(slowest, replica.acknowledged);
+        }
+        return slowest;
+    }
+
+public:
+    // Takes ownership of a listening socket; replicas connect to it.
+    ReplicationPrimary(HashTableLinearProbing<string, int>& table, int listenFd) : table(table), listenFd(listenFd) {
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+
+    ~ReplicationPrimary() {
+        for (auto& replica : replicas) {
+            close(replica.fd);
+        }
+        close(listenFd);
+    }
+
+    // Waits for one replica to connect and brings it up to date with a snapshot, returning once
+    // the replica has loaded it.
+    void acceptReplica() {
+        flush();
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            throw runtime_error(string("accept: ") + strerror(errno));
+        }
+        replicas.emplace_back();
+        replicas.back().fd = fd;
+        auto start = high_resolution_clock::now();
+        ostringstream snapshot;
+        table.saveSnapshot(snapshot);
+        sendFrame(replicas.back(), SnapshotFrame, snapshot.str());
+        collectAcknowledgements(true);
+        catchUpMicros.push_back(duration<double, micro>(high_resolution_clock::now() - start).count());
+    }
+
+    void insert(const string& key, int value) {
+        table.insert(key, value);
+        writeChangeRecord(batch, ChangeRecord<string, int>{ ++sequence, InsertChange, key, value });
+        batchRecords++;
+    }
+
+    bool remove(const string& key) {
+        if (!table.remove(key)) {
+            return false;
+        }
+        writeChangeRecord(batch, ChangeRecord<string, int>{ ++sequence, RemoveChange, key, 0 });
+        batchRecords++;
+        return true;
+    }
+
+    // Sends the logged changes to every replica as one frame and collects acknowledgements.
+    void flush() {
+        if (batchRecords > 0) {
+            string payload = batch.str();
+            for (auto& replica : replicas) {
+                sendFrame(replica, ChangesFrame, payload);
+            }
+            inFlight.emplace_back(sequence, high_resolution_clock::now());
+            batch.str(string());
+            batchRecords = 0;
+        }
+        collectAcknowledgements(false);
+        maxLag = max(maxLag, sequence - slowestAcknowledged());
+    }
+
+    // Reads the acknowledgements that have arrived, or with wait, blocks until every replica has
+    // acknowledged everything sent.
+    void collectAcknowledgements(bool wait) {
+        char buffer[4096];
+        for (auto& replica : replicas) {
+            while (true) {
+                ssize_t received = recv(replica.fd, buffer, sizeof(buffer), wait && replica.framesAnswered < replica.framesSent ? 0 : MSG_DONTWAIT);
+                if (received <= 0) {
+                    if (received == 0 || (errno != EAGAIN && errno != EINTR)) {
+                        throw runtime_error("Replica disconnected");
+                    }
+                    break;
+                }
+                replica.received.append(buffer, received);
+                size_t whole = replica.received.size() / 16 * 16;
+                for (size_t offset = 0; offset < whole; offset += 16) {
+                    memcpy(&replica.acknowledged, replica.received.data() + offset, 8);
+                    memcpy(&replica.checksum, replica.received.data() + offset + 8, 8);
+                    replica.framesAnswered++;
+                }
+                replica.received.erase(0, whole);
+            }
+        }
+        uint64_t slowest = slowestAcknowledged();
+        auto now = high_resolution_clock::now();
+        while (!inFlight.empty() && inFlight.front().first <= slowest) {
+            ackMicros.push_back(duration<double, micro>(now - inFlight.front().second).count());
+            inFlight.pop_front();
+        }
+    }
+
+    // Asks every replica for its table checksum and returns them, after all changes are applied.
+    vector<uint64_t> replicaChecksums() {
+        flush();
+        for (auto& replica : replicas) {
+            sendFrame(replica, ChecksumFrame, string());
+        }
+        collectAcknowledgements(true);   // The last answer of each replica is then the checksum's
+        vector<uint64_t> checksums;
+        for (const auto& replica : replicas) {
+            checksums.push_back(replica.checksum);
+        }
+        return checksums;
+    }
+
+    uint64_t getSequence() const { return sequence; }
+    uint64_t getMaxLag() const { return maxLag; }
+    const vector<double>& getAcknowledgementTimes() const { return ackMicros; }
+    const vector<double>& getCatchUpTimes() const { return catchUpMicros; }
+};
+
+// The replica side: connects to a primary and applies its stream to a table until the primary
+// goes away. Each frame is applied under guard in one go (batched apply), so readers sharing the
+// table through a LockedProtocol see whole batches.
+inline void runReplicaApplier(const string& primaryPath, HashTableLinearProbing<string, int>& table, mutex& guard) {
+    int fd = connectUnixSocket(primaryPath);
+    string payload;
+    uint64_t applied = 0;
+    try {
+        while (true) {
+            char header[13];
+            readExact(fd, header, sizeof(header));
+            uint64_t frameSequence;
+            uint32_t length;
+            memcpy(&frameSequence, header + 1, 8);
+            memcpy(&length, header + 9, 4);
+            payload.resize(length);
+            readExact(fd, &payload[0], length);
+            istringstream in(payload);
+            uint64_t checksum = 0;
+            {
+                lock_guard<mutex> hold(guard);
+                if (header[0] == SnapshotFrame) {
+                    table = HashTableLinearProbing<string, int>::loadSnapshot(in);
+                    table.setCompactionPolicy(0, 0.25);   // Removals must not fill the table with tombstones.
+                }
+                else if (header[0] == ChangesFrame) {
+                    ChangeRecord<string, int> record;
+                    while (readChangeRecord(in, record)) {
+                        if (record.operation == InsertChange) {
+                            table.insert(move(record.key), record.value);
+                        }
+                        else {
+                            table.remove(move(record.key));
+                        }
+                    }
+                }
+                else {
+                    checksum = tableChecksum(table);
+                }
+            }
+            applied = frameSequence;
+            char reply[16];
+            memcpy(reply, &applied, 8);
+            memcpy(reply + 8, &checksum, 8);
+            sendExact(fd, reply, sizeof(reply));
+        }
+    }
+    catch (const overflow_error& e) {
+        cerr << "Replica stopped applying: " << e.what() << endl;   // Closing tells the primary.
+    }
+    catch (const runtime_error&) {
+        // The primary closed the stream.
+    }
+    close(fd);
+}
+
+// A replica process of --replicate: applies the primary's stream in one thread and serves
+// read-only commands on readPath in another, until SIGTERM.
+inline int runReplicaNode(const string& primaryPath, const string& readPath, int capacity) {
+    serverStopRequested = false;
+    signal(SIGTERM, [](int) { serverStopRequested = true; });
+    signal(SIGINT, SIG_IGN);
+    HashTableLinearProbing<string, int> table(capacity);
+    mutex guard;
+    CommandProcessor processor(table);
+    processor.setReadOnly(true);
+    LockedProtocol<CommandProcessor> locked(processor, guard);
+    EpollServer<LockedProtocol<CommandProcessor>> server(locked, openUnixListener(readPath));
+    thread applier([&]() { runReplicaApplier(primaryPath, table, guard); });
+    server.run(serverStopRequested);
+    unlink(readPath.c_str());
+    applier.detach();   // Still blocked on the stream; the process is exiting anyway.
+    return 0;
+}
+
+// Runs --replicate N: a primary in this process with N forked replicas. It loads half of --keys
+// before the replicas connect (so they start from a snapshot), then writes --requests changes in
+// batches of --pipeline while client threads read from the replicas, and reports write rate,
+// replication lag, read throughput and whether every replica ends identical to the primary.
+inline int runReplicationMode(const DriverOptions& options) {
+    string prefix = "/tmp/hashtable-replication-" + to_string(getpid());
+    string primaryPath = prefix + "-primary.sock";
+    int capacity = max(options.capacity, options.keySpace * 2);   // Room for every key at load 0.5
+    HashTableLinearProbing<string, int> table(capacity);
+    table.setCompactionPolicy(0, 0.25);
+    ReplicationPrimary primary(table, openUnixListener(primaryPath));
+    for (int key = 0; key < options.keySpace / 2; ++key) {
+        primary.insert("key" + to_string(key), key);
+    }
+
+    vector<pid_t> children;
+    vector<string> readPaths;
+    for (int replica = 0; replica < options.replicaCount; ++replica) {
+        readPaths.push_back(prefix + "-replica" + to_string(replica) + ".sock");
+        cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            _exit(runReplicaNode(primaryPath, readPaths.back(), capacity));
+        }
+        children.push_back(pid);
+        primary.acceptReplica();
+    }
+
+    auto stopReplicas = [&]() {
+        for (pid_t pid : children) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+    };
+    vector<LoadReport> reports(readPaths.size());
+    vector<thread> readers;
+    try {
+        // Readers: every replica gets the same read-only load while the primary writes.
+        for (size_t replica = 0; replica < readPaths.size(); ++replica) {
+            readers.emplace_back([&, replica]() {
+                string path = readPaths[replica];
+                auto connectReplica = [path]() {
+                    for (int attempt = 0; ; ++attempt) {   // The replica may still be starting up.
+                        try {
+                            return connectUnixSocket(path);
+                        }
+                        catch (const runtime_error&) {
+                            if (attempt == 200) {
+                                throw;
+                            }
+                            this_thread::sleep_for(milliseconds(10));
+                        }
+                    }
+                };
+                reports[replica] = runLoadGenerator(connectReplica,
+                    max(1, options.connections / static_cast<int>(readPaths.size())), options.requests, options.pipeline, options.keySpace, 0);
+            });
+        }
+
+        mt19937 rng(7);
+        auto start = high_resolution_clock::now();
+        for (int done = 0; done < options.requests; done += options.pipeline) {
+            for (int i = 0; i < options.pipeline; ++i) {
+                string key = "key" + to_string(rng() % options.keySpace);
+                if (rng() % 10 == 0) {
+                    primary.remove(key);
+                }
+                else {
+                    primary.insert(key, static_cast<int>(rng() % 1000000));
+                }
+            }
+            primary.flush();
+        }
+        primary.collectAcknowledgements(true);
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        vector<double> times = primary.getAcknowledgementTimes();
+        sort(times.begin(), times.end());
+        auto percentile = [&](double p) { return times.empty() ? 0.0 : times[min(times.size() - 1, static_cast<size_t>(p * times.size()))]; };
+        const vector<double>& catchUp = primary.getCatchUpTimes();
+        cout << "Replicas caught up from the snapshot in at most "
+             << (catchUp.empty() ? 0.0 : *max_element(catchUp.begin(), catchUp.end())) / 1000 << " ms\n";
+        cout << "Primary: " << primary.getSequence() << " changes, " << options.requests / seconds
+             << " writes/sec replicated to " << options.replicaCount << " replicas in batches of " << options.pipeline << "\n"
+             << "Lag: at most " << primary.getMaxLag() << " changes behind; batch acknowledged after p50 "
+             << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max " << (times.empty() ? 0.0 : times.back()) << " us\n";
+        double reads = 0;
+        for (size_t replica = 0; replica < reports.size(); ++replica) {
+            cout << "Replica " << replica << " reads: ";
+            reports[replica].print(cout);
+            reads += reports[replica].opsPerSecond;
+        }
+        cout << "Total reads: " << reads << " ops/sec\n";
+
+        uint64_t expected = tableChecksum(table);
+        vector<uint64_t> checksums = primary.replicaChecksums();
+        int matching = static_cast<int>(count(checksums.begin(), checksums.end(), expected));
+        cout << matching << " of " << checksums.size() << " replicas match the primary (" << table.getSize() << " keys)\n";
+    }
+    catch (...) {
+        stopReplicas();   // Also ends the readers' connections.
+        for (auto& reader : readers) {
+            if (reader.joinable()) {
+                reader.join();
+            }
+        }
+        unlink(primaryPath.c_str());
+        throw;
+    }
+    stopReplicas();
+    unlink(primaryPath.c_str());
+    return 0;
+}
+
+// A Bitcask-style persistent store. Every put and remove is appended to the active segment file
+// and a HashTableLinearProbing maps each live key to where its value sits on disk, so memory holds
+// only the keys and their locations while the values can be far larger than RAM. A get is one
+// probe of the index and one pread.
+//
+// A record is a 24-byte header (checksum, sequence number, key length, value length) followed by
+// the key and the value; a value length of tombstoneLength marks a removal. When the active segment
+// is full it becomes immutable and a hint file with the key, sequence and value location of each of
+// its records is written next to it, so opening the store reads the small hint files instead of all
+// the data. Compaction copies the live records of the immutable segments into new segments, plus
+// the tombstones a partly finished compaction still needs, and deletes the old files. Because of compaction, file order is not record order: the rebuild keeps
+// whichever record of a key has the highest sequence number.
+class BitcaskStore {
+public:
+    struct ValueLocation {
+        uint32_t segment = 0;
+        uint32_t length = 0;     // Value bytes, or tombstoneLength while rebuilding
+        uint64_t offset = 0;     // Of the value within the segment file
+        uint64_t sequence = 0;
+    };
+
+private:
+    static constexpr uint32_t tombstoneLength = 0xFFFFFFFF;
+    static constexpr size_t headerBytes = 24;
+
+    struct Segment {
+        int fd = -1;             // -1 once the segment was compacted away (or never existed)
+        uint64_t bytes = 0;      // Length of the file
+        uint64_t liveBytes = 0;  // Bytes of the records the index still points at
+    };
+
+    // One record of a segment, as listed in its hint file.
+    struct HintEntry {
+        string key;
+        ValueLocation location;
+    };
+
+    string directory;
+    uint64_t segmentLimit;
+    HashTableLinearProbing<string, ValueLocation> index;
+    vector<Segment> segments;            // Indexed by segment id
+    uint32_t activeSegment = 0;
+    vector<HintEntry> activeHints;       // Hint entries of the records in the active segment
+    uint64_t nextSequence = 1;
+    mutable mutex guard;                 // Serialises the index and the segment list
+    mutex compaction;                    // Held for the whole of a compaction
+
+    thread compactor;
+    atomic<bool> stopCompactor{false};
+    int hintFilesRead = 0;
+    int segmentsScanned = 0;
+
+    string segmentPath(uint32_t id, const char* extension) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/segment-%06u.%s", id, extension);
+        return directory + name;
+    }
+
+    static uint64_t recordBytes(size_t keyLength, uint32_t valueLength) {
+        return headerBytes + keyLength + (valueLength == tombstoneLength ? 0 : valueLength);
+    }
+
+    // FNV-1a over everything after the checksum field.
+    static uint32_t recordChecksum(const char* data, size_t length) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    static string encodeRecord(uint64_t sequence, string_view key, string_view value, bool tombstone) {
+        string record(headerBytes, '\0');
+        uint32_t keyLength = static_cast<uint32_t>(key.size());
+        uint32_t valueLength = tombstone ? tombstoneLength : static_cast<uint32_t>(value.size());
+        memcpy(&record[8], &sequence, 8);
+        memcpy(&record[16], &keyLength, 4);
+        memcpy(&record[20], &valueLength, 4);
+        record.append(key.data(), key.size());
+        if (!tombstone) {
+            record.append(value.data(), value.size());
+        }
+        uint32_t checksum = recordChecksum(record.data() + 4, record.size() - 4);
+        memcpy(&record[0], &checksum, 4);
+        return record;
+    }
+
+    static void writeAt(int fd, const char* data, size_t length, uint64_t offset) {
+        while (length > 0) {
+            ssize_t written = pwrite(fd, data, length, static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw runtime_error(string("pwrite: ") + strerror(errno));
+            }
+            data += written;
+            length -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+    }
+
+    // Reads up to length bytes at offset; returns how many were read (less only at end of file).
+    static size_t readAt(int fd, char* data, size_t length, uint64_t offset) {
+        size_t total = 0;
+        while (total < length) {
+            ssize_t got = pread(fd, data + total, length - total, static_cast<off_t>(offset + total));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                throw runtime_error(string("pread: ") + strerror(errno));
+            }
+            if (got == 0) {
+                break;
+            }
+            total += static_cast<size_t>(got);
+        }
+        return total;
+    }
+
+    // Calls fn(key, value, location) for each intact record of a segment file in order, stopping
+    // at the first torn or corrupt record. Returns the length of the intact prefix.
+    template<typename Function>
+    static uint64_t scanSegment(int fd, uint32_t id, Function fn) {
+        struct stat status;
+        uint64_t fileBytes = fstat(fd, &status) == 0 ? static_cast<uint64_t>(status.st_size) : 0;
+        uint64_t offset = 0;
+        string record;
+        char header[headerBytes];
+        while (readAt(fd, header, headerBytes, offset) == headerBytes) {
+            uint32_t checksum, keyLength, valueLength;
+            uint64_t sequence;
+            memcpy(&checksum, header, 4);
+            memcpy(&sequence, header + 8, 8);
+            memcpy(&keyLength, header + 16, 4);
+            memcpy(&valueLength, header + 20, 4);
+            uint64_t length = recordBytes(keyLength, valueLength);
+            if (length > fileBytes - offset) {
+                break;   // A torn tail, or lengths that are garbage
+            }
+            record.resize(length);
+            if (readAt(fd, &record[0], length, offset) != length
+                || recordChecksum(record.data() + 4, length - 4) != checksum) {
+                break;
+            }
+            ValueLocation location;
+            location.segment = id;
+            location.length = valueLength;
+            location.offset = offset + headerBytes + keyLength;
+            location.sequence = sequence;
+            fn(string_view(record.data() + headerBytes, keyLength),
+               string_view(record.data() + headerBytes + keyLength, valueLength == tombstoneLength ? 0 : valueLength), location);
+            offset += length;
+        }
+        return offset;
+    }
+
+    // Writes a hint file through a temporary name so a crash never leaves a partial one.
+    void writeHints(uint32_t id, const vector<HintEntry>& hints) const {
+        string path = segmentPath(id, "hint");
+        {
+            ofstream out(path + ".tmp", ios::binary | ios::trunc);
+            writeSnapshotHeader(out, BitcaskHintSnapshot);
+            writeBinary(out, static_cast<uint64_t>(hints.size()));
+            for (const HintEntry& hint : hints) {
+                writeBinary(out, hint.key);
+                writeBinary(out, hint.location.sequence);
+                writeBinary(out, hint.location.offset);
+                writeBinary(out, hint.location.length);
+            }
+            if (!out.flush()) {
+                throw runtime_error("Cannot write " + path);
+            }
+        }
+        if (rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+            throw runtime_error("Cannot rename hint file " + path + ": " + strerror(errno));
+        }
+    }
+
+    // Calls fn(key, location) for each record listed in a segment's hint file. Returns false when
+    // the segment has no hint file.
+    template<typename Function>
+    bool readHints(uint32_t id, Function fn) const {
+        ifstream hintFile(segmentPath(id, "hint"), ios::binary);
+        if (!hintFile) {
+            return false;
+        }
+        readSnapshotHeader(hintFile, BitcaskHintSnapshot);
+        uint64_t count;
+        readBinary(hintFile, count);
+        HintEntry hint;
+        hint.location.segment = id;
+        for (uint64_t i = 0; i < count; ++i) {
+            readBinary(hintFile, hint.key);
+            readBinary(hintFile, hint.location.sequence);
+            readBinary(hintFile, hint.location.offset);
+            readBinary(hintFile, hint.location.length);
+            fn(hint.key, hint.location);
+        }
+        return true;
+    }
+
+    // Applies a recovered record to the index unless a newer record of its key was already seen.
+    // Removals stay in the index as tombstone entries until the rebuild is over, so a put with an
+    // older sequence found later cannot bring the key back.
+    void recover(const string& key, const ValueLocation& location) {
+        nextSequence = max(nextSequence, location.sequence + 1);
+        ValueLocation* existing = index.find(key);
+        if (existing != nullptr) {
+            if (existing->sequence > location.sequence) {
+                return;
+            }
+            if (existing->length != tombstoneLength) {
+                segments[existing->segment].liveBytes -= recordBytes(key.size(), existing->length);
+            }
+        }
+        if (location.length != tombstoneLength) {
+            segments[location.segment].liveBytes += recordBytes(key.size(), location.length);
+        }
+        index.insert(key, location);
+    }
+
+    // Reads every segment of the directory, from its hint file when there is one, and opens a
+    // fresh active segment after the last.
+    void openDirectory() {
+        mkdir(directory.c_str(), 0755);
+        DIR* listing = opendir(directory.c_str());
+        if (listing == nullptr) {
+            throw runtime_error("Cannot open directory " + directory + ": " + strerror(errno));
+        }
+        vector<uint32_t> ids;
+        while (dirent* item = readdir(listing)) {
+            unsigned id;
+            char extension[8];
+            if (sscanf(item->d_name, "segment-%u.%7s", &id, extension) == 2 && string(extension) == "data") {
+                ids.push_back(id);
+            }
+        }
+        closedir(listing);
+        sort(ids.begin(), ids.end());
+
+        segments.resize(ids.empty() ? 1 : ids.back() + 2);
+        for (uint32_t id : ids) {
+            Segment& segment = segments[id];
+            segment.fd = ::open(segmentPath(id, "data").c_str(), O_RDONLY | O_CLOEXEC);
+            if (segment.fd < 0) {
+                throw runtime_error("Cannot open " + segmentPath(id, "data") + ": " + strerror(errno));
+            }
+            struct stat status;
+            fstat(segment.fd, &status);
+            segment.bytes = static_cast<uint64_t>(status.st_size);
+
+            if (readHints(id, [&](const string& key, const ValueLocation& location) { recover(key, location); })) {
+                hintFilesRead++;
+            }
+            else {
+                // No hint file: the store was not closed cleanly. Scan the data and write one.
+                vector<HintEntry> hints;
+                segment.bytes = scanSegment(segment.fd, id, [&](string_view key, string_view, const ValueLocation& location) {
+                    hints.push_back({ string(key), location });
+                    recover(hints.back().key, location);
+                });
+                writeHints(id, hints);
+                segmentsScanned++;
+            }
+        }
+        index.erase_if([](const string&, const ValueLocation& location) { return location.length == tombstoneLength; },
+                       static_cast<int>(thread::hardware_concurrency()));
+
+        activeSegment = static_cast<uint32_t>(segments.size() - 1);
+        segments[activeSegment].fd = ::open(segmentPath(activeSegment, "data").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (segments[activeSegment].fd < 0) {
+            throw runtime_error("Cannot create " + segmentPath(activeSegment, "data") + ": " + strerror(errno));
+        }
+    }
+
+    // Seals the active segment with a hint file and starts a new one. Called with the lock held.
+    void rollSegment() {
+        writeHints(activeSegment, activeHints);
+        activeHints.clear();
+        activeSegment = static_cast<uint32_t>(segments.size());
+        segments.emplace_back();
+        segments[activeSegment].fd = ::open(segmentPath(activeSegment, "data").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (segments[activeSegment].fd < 0) {
+            throw runtime_error("Cannot create " + segmentPath(activeSegment, "data") + ": " + strerror(errno));
+        }
+    }
+
+    // Appends a record to the active segment and points the index at it. Called with the lock held.
+    void append(const string& key, string_view value, bool tombstone) {
+        string record = encodeRecord(nextSequence, key, value, tombstone);
+        if (segments[activeSegment].bytes > 0 && segments[activeSegment].bytes + record.size() > segmentLimit) {
+            rollSegment();
+        }
+        Segment& segment = segments[activeSegment];
+        writeAt(segment.fd, record.data(), record.size(), segment.bytes);
+
+        ValueLocation location;
+        location.segment = activeSegment;
+        location.length = tombstone ? tombstoneLength : static_cast<uint32_t>(value.size());
+        location.offset = segment.bytes + headerBytes + key.size();
+        location.sequence = nextSequence++;
+        segment.bytes += record.size();
+        activeHints.push_back({ key, location });
+
+        ValueLocation* existing = index.find(key);
+        if (existing != nullptr) {
+            segments[existing->segment].liveBytes -= recordBytes(key.size(), existing->length);
+        }
+        if (tombstone) {
+            index.remove(key);
+        }
+        else {
+            segment.liveBytes += record.size();
+            index.insert(key, location);
+        }
+    }
+
+    // Opens a segment for compaction output. Called with the lock held.
+    uint32_t addOutputSegment() {
+        uint32_t id = static_cast<uint32_t>(segments.size());
+        segments.emplace_back();
+        segments[id].fd = ::open(segmentPath(id, "data").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (segments[id].fd < 0) {
+            throw runtime_error("Cannot create " + segmentPath(id, "data") + ": " + strerror(errno));
+        }
+        return id;
+    }
+
+public:
+    // Opens (or creates) the store in directory. The index is a fixed-capacity table, so
+    // indexCapacity bounds the number of keys; segmentBytes is the size at which segments roll.
+    BitcaskStore(const string& directory, int indexCapacity, uint64_t segmentBytes = uint64_t(64) << 20)
+        : directory(directory), segmentLimit(segmentBytes), index(indexCapacity) {
+        index.setCompactionPolicy(0, 0.25, true);   // Removals leave tombstones; purge them as they go
+        openDirectory();
+    }
+
+    BitcaskStore(const BitcaskStore&) = delete;
+    BitcaskStore& operator=(const BitcaskStore&) = delete;
+
+    // Stops background compaction and writes the active segment's hint file, so the next open
+    // does not have to scan it.
+    ~BitcaskStore() {
+        stopBackgroundCompaction();
+        try {
+            if (segments[activeSegment].bytes > 0) {
+                writeHints(activeSegment, activeHints);
+            }
+            else {
+                unlink(segmentPath(activeSegment, "data").c_str());
+            }
+        }
+        catch (const exception& e) {
+            cerr << "Bitcask store: " << e.what() << endl;
+        }
+        for (Segment& segment : segments) {
+            if (segment.fd >= 0) {
+                close(segment.fd);
+            }
+        }
+    }
+
+    void put(const string& key, string_view value) {
+        if (value.size() >= tombstoneLength) {
+            throw invalid_argument("Value too large");
+        }
+        lock_guard<mutex> lock(guard);
+        append(key, value, false);
+    }
+
+    // Appends a tombstone; returns false (and writes nothing) when the key is not stored.
+    bool remove(const string& key) {
+        lock_guard<mutex> lock(guard);
+        if (index.find(key) == nullptr) {
+            return false;
+        }
+        append(key, string_view(), true);
+        return true;
+    }
+
+    // Copies the value of key into value; returns false when the key is not stored.
+    bool get(const string& key, string& value) const {
+        lock_guard<mutex> lock(guard);
+        const ValueLocation* location = index.find(key);
+        if (location == nullptr) {
+            return false;
+        }
+        value.resize(location->length);
+        if (readAt(segments[location->segment].fd, &value[0], location->length, location->offset) != location->length) {
+            throw runtime_error("Segment " + to_string(location->segment) + " is truncated");
+        }
+        return true;
+    }
+
+    string retrieve(const string& key) const {
+        string value;
+        if (!get(key, value)) {
+            throw runtime_error("Key not found");
+        }
+        return value;
+    }
+
+    bool contains(const string& key) const {
+        lock_guard<mutex> lock(guard);
+        return index.find(key) != nullptr;
+    }
+
+    // Forces the active segment to disk.
+    void sync() {
+        lock_guard<mutex> lock(guard);
+        fdatasync(segments[activeSegment].fd);
+    }
+
+    // Fraction of the bytes in immutable segments that belong to overwritten or removed records.
+    double garbageRatio() const {
+        lock_guard<mutex> lock(guard);
+        uint64_t total = 0, live = 0;
+        for (uint32_t id = 0; id < segments.size(); ++id) {
+            if (id != activeSegment && segments[id].fd >= 0) {
+                total += segments[id].bytes;
+                live += segments[id].liveBytes;
+            }
+        }
+        return total == 0 ? 0 : 1.0 - static_cast<double>(live) / total;
+    }
+
+    // Rewrites the live records of every immutable segment into new segments and deletes the old
+    // files; returns the bytes reclaimed. Puts and gets carry on meanwhile: records are copied
+    // without the lock, and a copy only replaces the index entry if the key was not written again
+    // in the meantime.
+    //
+    // The old files are unlinked one at a time, so a crash can leave any subset of them behind. A
+    // tombstone is therefore copied too while another input holds an older put of its key;
+    // otherwise a crash after its segment is gone but before the put's is would bring the key
+    // back. A tombstone whose older puts are all in its own segment goes with them, and one that
+    // was carried over is dropped by the next compaction, once those puts are gone.
+    uint64_t compact() {
+        lock_guard<mutex> compacting(compaction);
+        vector<uint32_t> inputs;
+        uint64_t inputBytes = 0;
+        {
+            lock_guard<mutex> lock(guard);
+            for (uint32_t id = 0; id < segments.size(); ++id) {
+                if (id != activeSegment && segments[id].fd >= 0) {
+                    inputs.push_back(id);
+                    inputBytes += segments[id].bytes;
+                }
+            }
+        }
+        if (inputs.empty()) {
+            return 0;
+        }
+
+        // The newest tombstone of every key that is still removed, from the inputs' hint files.
+        struct Removal {
+            uint64_t sequence = 0;
+            uint32_t segment = 0;
+            bool carry = false;   // Another input holds an older put of the key
+        };
+        vector<HintEntry> tombstones;
+        for (uint32_t id : inputs) {
+            auto collect = [&](string_view key, const ValueLocation& location) {
+                if (location.length == tombstoneLength) {
+                    tombstones.push_back({ string(key), location });
+                }
+            };
+            if (!readHints(id, collect)) {
+                int fd;
+                {
+                    lock_guard<mutex> lock(guard);
+                    fd = segments[id].fd;
+                }
+                scanSegment(fd, id, [&](string_view key, string_view, const ValueLocation& location) { collect(key, location); });
+            }
+        }
+        HashTableLinearProbing<string, Removal> removals(static_cast<int>(tombstones.size()) * 2 + 16);
+        {
+            lock_guard<mutex> lock(guard);
+            for (const HintEntry& tombstone : tombstones) {
+                const Removal* newest = removals.find(tombstone.key);
+                if (index.find(tombstone.key) == nullptr && (newest == nullptr || newest->sequence < tombstone.location.sequence)) {
+                    removals.insert(tombstone.key, Removal{ tombstone.location.sequence, tombstone.location.segment, false });
+                }
+            }
+        }
+        tombstones.clear();
+
+        struct Move {
+            string key;
+            ValueLocation from;
+            ValueLocation to;
+        };
+        vector<Move> moves;
+        vector<uint32_t> outputs;
+        vector<uint64_t> outputSizes;
+        int outputFd = -1;                // The segment vector can grow under us, so keep the fd
+        vector<HintEntry> outputHints;
+        uint64_t outputBytes = 0;
+        string buffer;
+
+        auto flushOutput = [&]() {
+            if (!buffer.empty()) {
+                writeAt(outputFd, buffer.data(), buffer.size(), outputBytes - buffer.size());
+                buffer.clear();
+            }
+        };
+        auto sealOutput = [&]() {
+            flushOutput();
+            fdatasync(outputFd);
+            writeHints(outputs.back(), outputHints);
+            outputHints.clear();
+            outputSizes.push_back(outputBytes);
+        };
+        // Starts a new output segment when a record of the given size does not fit in the current
+        // one. Called with the lock held.
+        auto reserveOutput = [&](uint64_t bytes) {
+            if (outputs.empty() || outputBytes + bytes > segmentLimit) {
+                if (!outputs.empty()) {
+                    sealOutput();
+                }
+                outputs.push_back(addOutputSegment());
+                outputFd = segments[outputs.back()].fd;
+                outputBytes = 0;
+            }
+        };
+
+        for (uint32_t id : inputs) {
+            int fd;
+            {
+                lock_guard<mutex> lock(guard);
+                fd = segments[id].fd;
+            }
+            scanSegment(fd, id, [&](string_view key, string_view value, const ValueLocation& location) {
+                if (location.length == tombstoneLength) {
+                    return;
+                }
+                string name(key);
+                {
+                    lock_guard<mutex> lock(guard);
+                    const ValueLocation* current = index.find(name);
+                    if (current == nullptr || current->segment != id || current->offset != location.offset) {
+                        // Overwritten or removed since. A removal newer than this put, in another
+                        // input, has to outlive this segment.
+                        Removal* removal = removals.find(name);
+                        if (removal != nullptr && removal->sequence > location.sequence && removal->segment != id) {
+                            removal->carry = true;
+                        }
+                        return;
+                    }
+                    reserveOutput(recordBytes(key.size(), location.length));
+                }
+                ValueLocation moved = location;
+                moved.segment = outputs.back();
+                moved.offset = outputBytes + headerBytes + key.size();
+                buffer += encodeRecord(location.sequence, key, value, false);
+                outputBytes += recordBytes(key.size(), location.length);
+                outputHints.push_back({ name, moved });
+                moves.push_back({ move(name), location, moved });
+                if (buffer.size() >= (1 << 20)) {
+                    flushOutput();
+                }
+            });
+        }
+        removals.for_each([&](const string& key, const Removal& removal) {
+            if (!removal.carry) {
+                return;
+            }
+            {
+                lock_guard<mutex> lock(guard);
+                reserveOutput(recordBytes(key.size(), tombstoneLength));
+            }
+            ValueLocation location;
+            location.segment = outputs.back();
+            location.length = tombstoneLength;
+            location.offset = outputBytes + headerBytes + key.size();
+            location.sequence = removal.sequence;
+            buffer += encodeRecord(removal.sequence, key, string_view(), true);
+            outputBytes += recordBytes(key.size(), tombstoneLength);
+            outputHints.push_back({ key, location });
+        });
+        if (!outputs.empty()) {
+            sealOutput();
+        }
+
+        lock_guard<mutex> lock(guard);
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            segments[outputs[i]].bytes = outputSizes[i];
+        }
+        for (const Move& item : moves) {
+            ValueLocation* current = index.find(item.key);
+            if (current != nullptr && current->segment == item.from.segment && current->offset == item.from.offset) {
+                *current = item.to;
+                segments[item.to.segment].liveBytes += recordBytes(item.key.size(), item.to.length);
+            }
+        }
+        uint64_t written = 0;
+        for (uint32_t id : outputs) {
+            written += segments[id].bytes;
+        }
+        for (uint32_t id : inputs) {
+            close(segments[id].fd);
+            segments[id] = Segment();
+            unlink(segmentPath(id, "data").c_str());
+            unlink(segmentPath(id, "hint").c_str());
+        }
+        return inputBytes - written;
+    }
+
+    // Runs compact() on a background thread whenever the garbage ratio of the immutable segments
+    // reaches threshold, checking every interval.
+    void startBackgroundCompaction(double threshold, milliseconds interval = milliseconds(100)) {
+        stopBackgroundCompaction();
+        stopCompactor = false;
+        compactor = thread([this, threshold, interval]() {
+            while (!stopCompactor) {
+                auto wake = steady_clock::now() + interval;
+                while (!stopCompactor && steady_clock::now() < wake) {
+                    this_thread::sleep_for(milliseconds(5));
+                }
+                if (!stopCompactor && garbageRatio() >= threshold) {
+                    try {
+                        compact();
+                    }
+                    catch (const exception& e) {
+                        cerr << "Background compaction failed: " << e.what() << endl;
+                    }
+                }
+            }
+        });
+    }
+
+    void stopBackgroundCompaction() {
+        stopCompactor = true;
+        if (compactor.joinable()) {
+            compactor.join();
+        }
+    }
+
+    int getSize() const {
+        lock_guard<mutex> lock(guard);
+        return index.getSize();
+    }
+
+    // Bytes of all segment files, live or not.
+    uint64_t getDiskBytes() const {
+        lock_guard<mutex> lock(guard);
+        uint64_t total = 0;
+        for (const Segment& segment : segments) {
+            total += segment.fd >= 0 ? segment.bytes : 0;
+        }
+        return total;
+    }
+
+    int getSegmentCount() const {
+        lock_guard<mutex> lock(guard);
+        return static_cast<int>(count_if(segments.begin(), segments.end(), [](const Segment& segment) { return segment.fd >= 0; }));
+    }
+
+    // How the last open rebuilt the index: segments read from hint files and segments scanned.
+    int getHintFilesRead() const { return hintFilesRead; }
+    int getSegmentsScanned() const { return segmentsScanned; }
+};
+
+// Runs --bitcask: loads --keys values of --value-size bytes into a store in directory, times
+// random gets, overwrites while background compaction runs, then reopens the store from its hint
+// files and again by scanning the segments.
+inline int runBitcaskMode(const DriverOptions& options) {
+    const string& directory = options.bitcaskDirectory;
+    int keys = options.keySpace;
+    int capacity = max(options.capacity, keys * 2);
+    uint64_t segmentBytes = uint64_t(16) << 20;
+    auto valueFor = [&](int key, int version) {
+        string value(options.valueBytes, 'a' + static_cast<char>((key + version) % 26));
+        string tag = to_string(key) + ":" + to_string(version);
+        value.replace(0, min(tag.size(), value.size()), tag, 0, min(tag.size(), value.size()));
+        return value;
+    };
+    auto rate = [](double count, double seconds) { return count / max(seconds, 1e-9); };
+    vector<int> version(keys, 0);
+    mt19937 rng(42);
+
+    {
+        BitcaskStore store(directory, capacity, segmentBytes);
+        auto start = high_resolution_clock::now();
+        for (int i = 0; i < keys; ++i) {
+            store.put("key" + to_string(i), valueFor(i, 0));
+        }
+        store.sync();
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+        double megabytes = static_cast<double>(keys) * options.valueBytes / (1 << 20);
+        cout << "Put " << keys << " values of " << options.valueBytes << " bytes: " << rate(keys, seconds) << " puts/sec, "
+             << rate(megabytes, seconds) << " MB/s, " << store.getSegmentCount() << " segments\n";
+
+        vector<string> lookups(options.requests);
+        for (auto& key : lookups) {
+            key = "key" + to_string(rng() % keys);
+        }
+        string value;
+        size_t bytes = 0;
+        start = high_resolution_clock::now();
+        for (const string& key : lookups) {
+            store.get(key, value);
+            bytes += value.size();
+        }
+        seconds = duration<double>(high_resolution_clock::now() - start).count();
+        cout << "Got " << lookups.size() << " random values: " << rate(static_cast<double>(lookups.size()), seconds) << " gets/sec ("
+             << seconds * 1e6 / lookups.size() << " us each, " << bytes / (1 << 20) << " MB read)\n";
+
+        store.startBackgroundCompaction(0.5);
+        start = high_resolution_clock::now();
+        int overwrites = keys * 3;
+        for (int i = 0; i < overwrites; ++i) {
+            int key = static_cast<int>(rng() % (keys / 2 + 1)) % keys;   // Overwrite the first half, so segments fill with garbage
+            store.put("key" + to_string(key), valueFor(key, ++version[key]));
+        }
+        seconds = duration<double>(high_resolution_clock::now() - start).count();
+        store.stopBackgroundCompaction();
+        cout << "Overwrote " << overwrites << " values with background compaction: " << rate(overwrites, seconds) << " puts/sec, "
+             << store.getDiskBytes() / (1 << 20) << " MB on disk in " << store.getSegmentCount() << " segments\n";
+
+        start = high_resolution_clock::now();
+        uint64_t reclaimed = store.compact();
+        seconds = duration<double>(high_resolution_clock::now() - start).count();
+        cout << "Final compaction reclaimed " << reclaimed / (1 << 20) << " MB in " << seconds << " s; "
+             << store.getDiskBytes() / (1 << 20) << " MB on disk\n";
+    }
+
+    // Reopen twice: once from the hint files, once after deleting them so every segment is scanned.
+    for (bool withHints : { true, false }) {
+        if (!withHints) {
+            DIR* listing = opendir(directory.c_str());
+            while (dirent* item = listing != nullptr ? readdir(listing) : nullptr) {
+                string name = item->d_name;
+                if (name.size() > 5 && name.compare(name.size() - 5, 5, ".hint") == 0) {
+                    unlink((directory + "/" + name).c_str());
+                }
+            }
+            if (listing != nullptr) {
+                closedir(listing);
+            }
+        }
+        auto start = high_resolution_clock::now();
+        BitcaskStore store(directory, capacity, segmentBytes);
+        double seconds = duration<double>(high_resolution_clock::now() - start).count();
+
+        int mismatches = 0;
+        string value;
+        for (int i = 0; i < keys; ++i) {
+            if (!store.get("key" + to_string(i), value) || value != valueFor(i, version[i])) {
+                mismatches++;
+            }
+        }
+        cout << "Reopened " << (withHints ? "from " + to_string(store.getHintFilesRead()) + " hint files"
+                                          : "by scanning " + to_string(store.getSegmentsScanned()) + " segments")
+             << " in " << seconds * 1000 << " ms: " << store.getSize() << " keys, " << mismatches << " stale or missing\n";
+    }
+    return 0;
+}
+
+// An out-of-core hash table for data sets larger than memory. The slots live in a file of
+// 4 KiB pages, and only a buffer pool of them is kept in memory, replaced with CLOCK. Each key has
+// two candidate pages and goes to the first unless it is full. An in-memory directory records how
+// many slots of each page are used and a 16-bit fingerprint per slot. A lookup reads only the
+// pages whose fingerprints match, so a hit costs at most one page read (bar a false match, about
+// one in 250 per page) and most misses cost none. findBatch gathers the pages a batch of keys
+// needs and reads them in parallel through io_uring, or with pread where io_uring is missing.
+//
+// The file is opened with O_DIRECT where the file system allows it, so the page cache does not
+// quietly hold the data the pool is too small for. It is scratch space: the directory exists only
+// in memory, and the file is removed when the table is destroyed.
+template<typename K, typename V>
+class PagedHashTable {
+    static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                  "Paged entries are copied to and from disk as bytes");
+
+public:
+    static constexpr size_t pageBytes = 4096;
+
+private:
+    struct Slot {
+        K key;
+        V value;
+    };
+
+    static constexpr int slotsPerPage = static_cast<int>(pageBytes / sizeof(Slot));
+    static constexpr size_t batchPages = 64;   // Most pages one findBatch round pins and reads
+
+    struct PageInfo {
+        int32_t frame = -1;       // Buffer pool frame holding the page, or -1
+        uint16_t count = 0;       // Slots in use; they are the first count slots of the page
+    };
+
+    struct Frame {
+        uint32_t page = 0;
+        bool used = false;
+        bool referenced = false;  // CLOCK's second-chance bit
+        bool dirty = false;
+        bool pinned = false;      // Needed by the findBatch round in progress
+    };
+
+    string path;
+    int fd = -1;
+    bool directIo = false;
+    uint32_t pageCount;
+    vector<PageInfo> directory;
+    vector<uint16_t> fingerprints;    // slotsPerPage per page
+    vector<Frame> frames;
+    char* pool = nullptr;             // frames.size() pages, aligned for O_DIRECT
+    size_t clockHand = 0;
+    int size = 0;
+    uint64_t pageReads = 0;
+    uint64_t pageWrites = 0;
+    uint64_t poolHits = 0;
+#if HASH_TABLE_HAS_IO_URING
+    unique_ptr<IoUring> ring;         // Null when the kernel has no io_uring
+#endif
+
+    static uint32_t reduce(uint64_t bits, uint32_t range) {
+        return static_cast<uint32_t>((static_cast<uint64_t>(static_cast<uint32_t>(bits)) * range) >> 32);
+    }
+
+    static uint64_t hashKey(const K& key) { return mixHash(hash<K>()(key)); }
+    static uint16_t tagOf(uint64_t hashValue) { return static_cast<uint16_t>(hashValue >> 48); }
+
+    uint32_t candidatePage(uint64_t hashValue, int choice) const {
+        uint32_t page = reduce(choice == 0 ? hashValue : mixHash(hashValue + 1), pageCount);
+        return choice == 1 && page == candidatePage(hashValue, 0) ? (page + 1) % pageCount : page;
+    }
+
+    Slot* slotsIn(int frame) const { return reinterpret_cast<Slot*>(pool + static_cast<size_t>(frame) * pageBytes); }
+    const uint16_t* tagsOf(uint32_t page) const { return &fingerprints[static_cast<size_t>(page) * slotsPerPage]; }
+
+    bool mayHold(uint32_t page, uint16_t tag) const {
+        const uint16_t* tags = tagsOf(page);
+        for (int i = 0; i < directory[page].count; ++i) {
+            if (tags[i] == tag) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void readPage(uint32_t page, int frame) {
+        ssize_t got = pread(fd, slotsIn(frame), pageBytes, static_cast<off_t>(page) * pageBytes);
+        if (got != static_cast<ssize_t>(pageBytes)) {
+            throw runtime_error("Cannot read page " + to_string(page) + ": " + (got < 0 ? strerror(errno) : "short read"));
+        }
+        pageReads++;
+    }
+
+    void writeBack(Frame& frame, int index) {
+        if (frame.dirty) {
+            ssize_t put = pwrite(fd, slotsIn(index), pageBytes, static_cast<off_t>(frame.page) * pageBytes);
+            if (put != static_cast<ssize_t>(pageBytes)) {
+                throw runtime_error("Cannot write page " + to_string(frame.page) + ": " + (put < 0 ? strerror(errno) : "short write"));
+            }
+            frame.dirty = false;
+            pageWrites++;
+        }
+    }
+
+    // Picks a frame with CLOCK, writing back and unmapping the page it held.
+    int acquireFrame() {
+        for (size_t step = 0; step < 2 * frames.size() + 1; ++step) {
+            int index = static_cast<int>(clockHand);
+            Frame& frame = frames[clockHand];
+            clockHand = (clockHand + 1) % frames.size();
+            if (!frame.used) {
+                return index;
+            }
+            if (frame.pinned) {
+                continue;
+            }
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            writeBack(frame, index);
+            directory[frame.page].frame = -1;
+            frame.used = false;
+            return index;
+        }
+        throw runtime_error("Buffer pool is too small");
+    }
+
+    // Maps page into a frame without reading it; returns the frame and whether it still needs a read.
+    pair<int, bool> mapPage(uint32_t page) {
+        int index = directory[page].frame;
+        if (index >= 0) {
+            frames[index].referenced = true;
+            return make_pair(index, false);
+        }
+        index = acquireFrame();
+        Frame& frame = frames[index];
+        frame.page = page;
+        frame.used = true;
+        frame.referenced = true;
+        frame.dirty = false;
+        directory[page].frame = index;
+        if (directory[page].count == 0) {
+            memset(slotsIn(index), 0, pageBytes);   // Nothing on disk worth reading
+            return make_pair(index, false);
+        }
+        return make_pair(index, true);
+    }
+
+    int loadPage(uint32_t page) {
+        if (directory[page].frame >= 0) {
+            poolHits++;
+        }
+        pair<int, bool> mapped = mapPage(page);
+        if (mapped.second) {
+            readPage(page, mapped.first);
+        }
+        return mapped.first;
+    }
+
+    // Returns the slot of key in page, loading the page only if a fingerprint matches, or -1.
+    int findInPage(uint32_t page, const K& key, uint16_t tag) {
+        if (!mayHold(page, tag)) {
+            return -1;
+        }
+        Slot* slots = slotsIn(loadPage(page));
+        const uint16_t* tags = tagsOf(page);
+        for (int i = 0; i < directory[page].count; ++i) {
+            if (tags[i] == tag && slots[i].key == key) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+public:
+    // Creates a table of pageCount pages in the file at path, with a buffer pool of poolPages
+    // pages. Capacity is about pageCount * slotsPerPage keys; past a load of 0.9 the second
+    // choices start filling up too.
+    PagedHashTable(const string& path, uint32_t pageCount, size_t poolPages)
+        : path(path), pageCount(max<uint32_t>(1, pageCount)), directory(this->pageCount),
+          fingerprints(static_cast<size_t>(this->pageCount) * slotsPerPage), frames(max<size_t>(2 * batchPages, poolPages)) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        directIo = fd >= 0;
+        if (fd < 0) {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);  // tmpfs and friends refuse O_DIRECT
+        }
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(this->pageCount) * pageBytes) != 0) {
+            int error = errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw runtime_error("Cannot create " + path + ": " + strerror(error));
+        }
+        if (!directIo) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+        }
+        pool = static_cast<char*>(aligned_alloc(pageBytes, frames.size() * pageBytes));
+        if (pool == nullptr) {
+            close(fd);
+            throw bad_alloc();
+        }
+#if HASH_TABLE_HAS_IO_URING
+        try {
+            ring.reset(new IoUring(batchPages));
+        }
+        catch (const exception&) {
+            ring.reset();   // findBatch falls back to pread
+        }
+#endif
+    }
+
+    PagedHashTable(const PagedHashTable&) = delete;
+    PagedHashTable& operator=(const PagedHashTable&) = delete;
+
+    ~PagedHashTable() {
+        free(pool);
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    // The page a key goes to unless it is full; loading keys in home page order keeps the pool's
+    // working set to a page or two.
+    uint32_t homePage(const K& key) const {
+        return candidatePage(hashKey(key), 0);
+    }
+
+    bool find(const K& key, V& value) {
+        uint64_t hashValue = hashKey(key);
+        uint16_t tag = tagOf(hashValue);
+        for (int choice = 0; choice < 2; ++choice) {
+            uint32_t page = candidatePage(hashValue, choice);
+            int slot = findInPage(page, key, tag);
+            if (slot >= 0) {
+                value = slotsIn(directory[page].frame)[slot].value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    V retrieve(const K& key) {
+        V value;
+        if (!find(key, value)) {
+            throw runtime_error("Key not found");
+        }
+        return value;
+    }
+
+    bool contains(const K& key) {
+        V value;
+        return find(key, value);
+    }
+
+    void insert(const K& key, const V& value) {
+        uint64_t hashValue = hashKey(key);
+        uint16_t tag = tagOf(hashValue);
+        for (int choice = 0; choice < 2; ++choice) {
+            uint32_t page = candidatePage(hashValue, choice);
+            int slot = findInPage(page, key, tag);
+            if (slot >= 0) {
+                int frame = directory[page].frame;
+                slotsIn(frame)[slot].value = value;
+                frames[frame].dirty = true;
+                return;
+            }
+        }
+        uint32_t page = candidatePage(hashValue, 0);
+        if (directory[page].count == slotsPerPage) {
+            page = candidatePage(hashValue, 1);
+            if (directory[page].count == slotsPerPage) {
+                throw overflow_error("Hash table is full");
+            }
+        }
+        int frame = loadPage(page);
+        int slot = directory[page].count++;
+        slotsIn(frame)[slot] = Slot{ key, value };
+        fingerprints[static_cast<size_t>(page) * slotsPerPage + slot] = tag;
+        frames[frame].dirty = true;
+        size++;
+    }
+
+    // Removes key by moving the page's last slot into its place.
+    bool remove(const K& key) {
+        uint64_t hashValue = hashKey(key);
+        uint16_t tag = tagOf(hashValue);
+        for (int choice = 0; choice < 2; ++choice) {
+            uint32_t page = candidatePage(hashValue, choice);
+            int slot = findInPage(page, key, tag);
+            if (slot >= 0) {
+                int frame = directory[page].frame;
+                int last = --directory[page].count;
+                slotsIn(frame)[slot] = slotsIn(frame)[last];
+                fingerprints[static_cast<size_t>(page) * slotsPerPage + slot] = tagsOf(page)[last];
+                frames[frame].dirty = true;
+                size--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Looks up count keys, setting found[i] and, for hits, values[i]. Keys are taken in rounds:
+    // each round pins every page its keys' fingerprints point at, reads the missing ones with one
+    // io_uring submission, and then probes them all from memory.
+    void findBatch(const K* keys, size_t count, V* values, bool* found) {
+        vector<uint32_t> pinned;
+        vector<pair<uint32_t, int>> reads;   // (page, frame) still to be read
+        size_t first = 0;
+        while (first < count) {
+            size_t last = first;
+            for (; last < count; ++last) {
+                uint64_t hashValue = hashKey(keys[last]);
+                uint16_t tag = tagOf(hashValue);
+                uint32_t wanted[2];
+                int needed = 0;
+                for (int choice = 0; choice < 2; ++choice) {
+                    uint32_t page = candidatePage(hashValue, choice);
+                    if (mayHold(page, tag) && (directory[page].frame < 0 || !frames[directory[page].frame].pinned)) {
+                        wanted[needed++] = page;
+                    }
+                }
+                if (pinned.size() + needed > batchPages) {
+                    break;
+                }
+                for (int i = 0; i < needed; ++i) {
+                    pair<int, bool> mapped = mapPage(wanted[i]);
+                    frames[mapped.first].pinned = true;
+                    pinned.push_back(wanted[i]);
+                    if (mapped.second) {
+                        reads.emplace_back(wanted[i], mapped.first);
+                    }
+                }
+            }
+
+            bool submitted = false;
+#if HASH_TABLE_HAS_IO_URING
+            if (ring && reads.size() > 1) {
+                for (size_t i = 0; i < reads.size(); ++i) {
+                    io_uring_sqe* sqe = ring->getSqe();
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = fd;
+                    sqe->addr = reinterpret_cast<uint64_t>(slotsIn(reads[i].second));
+                    sqe->len = pageBytes;
+                    sqe->off = static_cast<uint64_t>(reads[i].first) * pageBytes;
+                    sqe->user_data = i;
+                }
+                size_t completed = 0;
+                while (completed < reads.size()) {
+                    if (ring->submitAndWait(1) < 0 && errno != EINTR) {
+                        throw runtime_error(string("io_uring_enter: ") + strerror(errno));
+                    }
+                    ring->forEachCompletion([&](const io_uring_cqe& cqe) {
+                        const pair<uint32_t, int>& read = reads[cqe.user_data];
+                        if (cqe.res != static_cast<int>(pageBytes)) {
+                            readPage(read.first, read.second);   // Kernels without IORING_OP_READ, or a short read
+                        }
+                        else {
+                            pageReads++;
+                        }
+                        completed++;
+                    });
+                }
+                submitted = true;
+            }
+#endif
+            if (!submitted) {
+                for (const auto& read : reads) {
+                    readPage(read.first, read.second);
+                }
+            }
+
+            for (size_t i = first; i < last; ++i) {
+                found[i] = find(keys[i], values[i]);
+            }
+            for (uint32_t page : pinned) {
+                frames[directory[page].frame].pinned = false;
+            }
+            pinned.clear();
+            reads.clear();
+            first = last;
+        }
+    }
+
+    // Writes every dirty page back to the file.
+    void flush() {
+        for (size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i].used) {
+                writeBack(frames[i], static_cast<int>(i));
+            }
+        }
+    }
+
+    int getSize() const { return size; }
+    uint32_t getPageCount() const { return pageCount; }
+    size_t getPoolPages() const { return frames.size(); }
+    static constexpr int getSlotsPerPage() { return slotsPerPage; }
+    // Memory the directory takes per page of the file, outside the pool.
+    static constexpr size_t getDirectoryBytesPerPage() { return sizeof(PageInfo) + slotsPerPage * sizeof(uint16_t); }
+    bool usesDirectIo() const { return directIo; }
+    bool usesIoUring() const {
+#if HASH_TABLE_HAS_IO_URING
+        return ring != nullptr;
+#else
+        return false;
+#endif
+    }
+    uint64_t getPageReads() const { return pageReads; }
+    uint64_t getPageWrites() const { return pageWrites; }
+    uint64_t getPoolHits() const { return poolHits; }
+
+    // Memory the table keeps outside the pool: the directory and the fingerprints.
+    size_t getDirectoryBytes() const {
+        return directory.size() * sizeof(PageInfo) + fingerprints.size() * sizeof(uint16_t);
+    }
+};
+
+// Runs --paged: builds a PagedHashTable whose file is four times --memory, then times random
+// lookups one at a time and in batches, about a tenth of them for missing keys. The directory
+// counts against --memory too, so the buffer pool gets what is left after it.
+inline int runPagedMode(const DriverOptions& options) {
+    using Table = PagedHashTable<uint64_t, uint64_t>;
+    size_t memoryBytes = static_cast<size_t>(options.memoryMegabytes) << 20;
+    uint32_t pageCount = static_cast<uint32_t>(memoryBytes * 4 / Table::pageBytes);
+    size_t directoryBytes = static_cast<size_t>(pageCount) * Table::getDirectoryBytesPerPage();
+    size_t poolPages = max<size_t>(1, (memoryBytes - min(memoryBytes, directoryBytes)) / Table::pageBytes);
+    Table table(options.pagedFile, pageCount, poolPages);
+    size_t keyCount = static_cast<size_t>(pageCount) * Table::getSlotsPerPage() * 3 / 4;
+    cout << "Paged table: " << pageCount << " pages (" << (static_cast<uint64_t>(pageCount) * Table::pageBytes >> 20) << " MB file), "
+         << poolPages << " page pool (" << (poolPages * Table::pageBytes >> 20) << " MB) and " << (table.getDirectoryBytes() >> 20)
+         << " MB directory in " << options.memoryMegabytes << " MB; " << (table.usesDirectIo() ? "direct I/O" : "buffered I/O (no O_DIRECT here)") << ", "
+         << (table.usesIoUring() ? "io_uring" : "pread") << " batch reads\n";
+
+    // Load in home page order, so each page is filled once and written back once.
+    vector<pair<uint32_t, uint64_t>> load(keyCount);
+    for (size_t i = 0; i < keyCount; ++i) {
+        load[i] = make_pair(table.homePage(i * 2), i * 2);   // Odd keys are the missing ones
+    }
+    sort(load.begin(), load.end());
+    auto start = high_resolution_clock::now();
+    for (const auto& item : load) {
+        table.insert(item.second, item.second + 1);
+    }
+    table.flush();
+    double seconds = duration<double>(high_resolution_clock::now() - start).count();
+    cout << "Loaded " << keyCount << " keys in " << seconds << " s (" << keyCount / seconds << " inserts/sec, "
+         << table.getPageWrites() << " page writes)\n";
+    load.clear();
+    load.shrink_to_fit();
+
+    mt19937_64 rng(42);
+    vector<uint64_t> keys(options.requests);
+    for (auto& key : keys) {
+        key = (rng() % keyCount) * 2 + (rng() % 10 == 0 ? 1 : 0);
+    }
+    vector<uint64_t> values(keys.size());
+    unique_ptr<bool[]> found(new bool[keys.size()]);
+
+    auto measure = [&](const string& name, function<void()> run) {
+        uint64_t readsBefore = table.getPageReads();
+        uint64_t hitsBefore = table.getPoolHits();
+        auto begin = high_resolution_clock::now();
+        run();
+        double elapsed = duration<double>(high_resolution_clock::now() - begin).count();
+        size_t hits = 0, wrong = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            hits += found[i];
+            wrong += found[i] != (keys[i] % 2 == 0) || (found[i] && values[i] != keys[i] + 1);
+        }
+        cout << name << ": " << keys.size() / elapsed << " lookups/sec, "
+             << static_cast<double>(table.getPageReads() - readsBefore) / keys.size() << " page reads and "
+             << static_cast<double>(table.getPoolHits() - hitsBefore) / keys.size() << " pool hits per lookup, "
+             << hits << " found, " << wrong << " wrong\n";
+    };
+    measure("Single lookups", [&]() {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            found[i] = table.find(keys[i], values[i]);
+        }
+    });
+    measure("Batched lookups", [&]() {
+        table.findBatch(keys.data(), keys.size(), values.data(), found.get());
+    });
+    return 0;
+}
+
+// Runs --loadgen against a server started with --serve (a socket path) or --sharded (a port
+// number), then prints the STATS of the shard that answers it.
+inline int runLoadGeneratorMode(const DriverOptions& options) {
+    string path = options.socketPath;
+    function<int()> connectClient = [path]() { return connectUnixSocket(path); };
+    if (path.find_first_not_of("0123456789") == string::npos) {
+        int port = stoi(path);
+        connectClient = [port]() { return connectTcpSocket(port); };
+    }
+    runLoadGenerator(connectClient, options.connections, options.requests, options.pipeline, options.keySpace).print(cout);
+    cout << queryServer(connectClient(), "STATS") << "\n";
+    return 0;
+}
+
+// Runs --compare-backends: the same load against an in-process server on each backend in turn,
+// reporting throughput and the system calls each backend made per request.
+inline int runBackendComparison(const DriverOptions& options) {
+    string path = "/tmp/hashtable-" + to_string(getpid()) + ".sock";
+    for (string backend : { "epoll", "io_uring" }) {
+        HashTableLinearProbing<string, int> table(options.capacity);
+        CommandProcessor processor(table);
+        atomic<bool> stop(false);
+        int listenFd = openUnixListener(path);
+        thread server([&]() { serveWithBackend(backend, processor, listenFd, stop); });
+        LoadReport report = runLoadGenerator([&]() { return connectUnixSocket(path); },
+            options.connections, options.requests, options.pipeline, options.keySpace);
+        string stats = queryServer(connectUnixSocket(path), "STATS");
+        stop = true;
+        server.join();
+        unlink(path.c_str());
+        cout << backend << ": ";
+        report.print(cout);
+        cout << "  " << stats << "\n";
+    }
+    return 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+    DriverOptions options;
+    try {
+        options = parseDriverOptions(argc, argv);
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n"
+             << "Usage: " << argv[0] << " [--capacity N] [--batch [file] [--record trace]] [--replay trace]\n"
+             << "       " << argv[0] << " [--capacity N] --serve socket [--backend epoll|io_uring]\n"
+             << "       " << argv[0] << " --loadgen socket|port [--connections N] [--requests N] [--pipeline N] [--keys N]\n"
+             << "       " << argv[0] << " --compare-backends [load generator options]\n"
+             << "       " << argv[0] << " [--capacity N] --memcached port|socket [--max-items N] [--memory MB] [--backend epoll|io_uring]\n"
+             << "       " << argv[0] << " --memcached-check\n"
+             << "       " << argv[0] << " [--capacity N] --sharded port [--reactors N]\n"
+             << "       " << argv[0] << " --scaling-report [load generator options]\n"
+             << "       " << argv[0] << " --shm-writer name [--keys N | --load file --capacity N]\n"
+             << "       " << argv[0] << " --shm-reader name [--requests N]\n"
+             << "       " << argv[0] << " --cluster N [--keys N] [--connections N] [--requests N] [--pipeline N]\n"
+             << "       " << argv[0] << " --replicate N [--keys N] [--connections N] [--requests N] [--pipeline N]\n"
+             << "       " << argv[0] << " --bitcask dir [--keys N] [--value-size N] [--requests N]\n"
+             << "       " << argv[0] << " --paged file [--memory MB] [--requests N]\n"
+             << "       " << argv[0] << " --external-build snapshot [--load file --capacity N | --keys N] [--memory MB]\n"
+             << "       " << argv[0] << " --join N\n"
+             << "       " << argv[0] << " --group-by N\n";
+        return 2;
+    }
+#if defined(__linux__)
+    try {
+        if (options.serve) {
+            return runServerMode(options);
+        }
+        if (options.loadgen) {
+            return runLoadGeneratorMode(options);
+        }
+        if (options.compareBackends) {
+            return runBackendComparison(options);
+        }
+        if (options.memcachedCheck) {
+            return runMemcachedCheck(options);
+        }
+        if (options.memcached) {
+            return runMemcachedMode(options);
+        }
+        if (options.sharded) {
+            return runShardedMode(options);
+        }
+        if (options.scalingReport) {
+            return runScalingReport(options);
+        }
+        if (options.sharedWriter) {
+            return runSharedWriterMode(options);
+        }
+        if (options.sharedReader) {
+            return runSharedReaderMode(options);
+        }
+        if (options.clusterNodes > 0) {
+            return runClusterMode(options);
+        }
+        if (options.replicaCount > 0) {
+            return runReplicationMode(options);
+        }
+        if (!options.bitcaskDirectory.empty()) {
+            return runBitcaskMode(options);
+        }
+        if (!options.pagedFile.empty()) {
+            return runPagedMode(options);
+        }
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+#else
+    if (options.serve || options.loadgen || options.compareBackends || options.memcachedCheck || options.memcached || options.sharded || options.scalingReport
+        || options.sharedWriter || options.sharedReader || options.clusterNodes > 0
+        || options.replicaCount > 0 || !options.bitcaskDirectory.empty()
+        || !options.pagedFile.empty()) {
+        cerr << "Server modes need Linux (epoll and Unix domain sockets)." << endl;
+        return 1;
+    }
+#endif
+    if (!options.replayFile.empty()) {
+        return runReplayMode(options);
+    }
+    if (options.groupRows > 0) {
+        return runGroupByMode(options);
+    }
+    if (options.joinRows > 0) {
+        return runJoinMode(options);
+    }
+    if (!options.externalSnapshot.empty()) {
+        try {
+            return runExternalBuildMode(options);
+        }
+        catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+    }
+    if (options.batch) {
+        return runBatchMode(options);
+    }
+
+    HashTableLinearProbing<string, int> hashTable(options.capacity);  // capacity
+
+    int choice;
+
+    while (true) {
+        hashTable.displayMenu();
+        cin >> choice;
+
+        switch (choice) {
+        case 1: {
+            string key;
+            int value;
+            cout << "Enter key: ";
+            cin >> key;
+            cout << "Enter value: ";
+            cin >> value;
+            try {
+                hashTable.insert(key, value);
+                cout << "Inserted (" << key << ", " << value << ") into the Hash Table.\n";
+            }
+            catch (const overflow_error& e) {
+                cout << "Error: " << e.what() << endl;
+            }
+            break;
+        }
+        case 2: {
+            string key;
+            cout << "Enter key: ";
+            cin >> key;
+            try {
+                int value = hashTable.retrieve(key);
+                cout << "Value at key '" << key << "' is " << value << ".\n";
+            }
+            catch (const runtime_error& e) {
+                cout << "Error: " << e.what() << endl;
+            }
+            break;
+        }
+        case 3: {
+            string key;
+            cout << "Enter key: ";
+            cin >> key;
+            if (hashTable.remove(key)) {
+                cout << "Key '" << key << "' has been removed.\n";
+            }
+            else {
+                cout << "Key '" << key << "' not found.\n";
+            }
+            break;
+        }
+        case 4: {
+            int numTests;
+            cout << "Enter number of operations for performance testing (e.g., 100, 1000, 10000): ";
+            cin >> numTests;
+            hashTable.performTest(numTests);
+            break;
+        }
+        case 5:
+            cout << "Exiting program.\n";
+            return 0;
+        case 6: {
+            int numEntries;
+            cout << "Enter number of entries for the scan benchmark (e.g., 10000, 1000000): ";
+            cin >> numEntries;
+            hashTable.performScanTest(numEntries);
+            break;
+        }
+        case 7: {
+            int numEntries;
+            cout << "Enter number of entries for the parallel benchmark (e.g., 1000000, 100000000): ";
+            cin >> numEntries;
+            hashTable.performParallelTest(numEntries);
+            break;
+        }
+        case 8: {
+            int entriesPerTable;
+            cout << "Enter number of entries per partial table (e.g., 10000, 100000): ";
+            cin >> entriesPerTable;
+            hashTable.performMergeTest(entriesPerTable);
+            break;
+        }
+        case 9: {
+            int numEntries;
+            cout << "Enter number of keys for the perfect hash benchmark (e.g., 100000, 1000000): ";
+            cin >> numEntries;
+            performPerfectHashTest(numEntries);
+            break;
+        }
+        case 10: {
+            int numRequests;
+            cout << "Enter number of simulated requests (e.g., 10000, 100000): ";
+            cin >> numRequests;
+            performScratchTableTest(numRequests);
+            break;
+        }
+        case 11: {
+            int capacity;
+            cout << "Enter table capacity for the probe benchmark (e.g., 100000, 1000000): ";
+            cin >> capacity;
+            performProbeTest(capacity);
+            break;
+        }
+        case 12: {
+            int capacity;
+            cout << "Enter table capacity for the latency benchmark (e.g., 100000, 1000000): ";
+            cin >> capacity;
+            performVariantTest(capacity);
+            break;
+        }
+        default:
+            cout << "Invalid choice. Please try again.\n";
+            break;
+        }
+    }
+
+    return 0;
+}